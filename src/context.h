@@ -8,19 +8,57 @@
 #ifndef IPTS_CONTEXT_H
 #define IPTS_CONTEXT_H
 
+#include <linux/atomic.h>
 #include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/hid.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
 #include <linux/mei_cl_bus.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "mei.h"
 #include "resources.h"
 #include "spec-mei.h"
+#include "stats.h"
 #include "thread.h"
 
+/**
+ * enum ipts_start_phase - The steps of starting the driver, for measuring how long they take.
+ *
+ * @IPTS_PHASE_READY:
+ *     Waiting for the touch sensor to become ready.
+ *
+ * @IPTS_PHASE_DEVICE_INFO:
+ *     Reading information about the device.
+ *
+ * @IPTS_PHASE_RESOURCES:
+ *     Allocating buffers, while the ME is looking up the HID descriptor.
+ *
+ * @IPTS_PHASE_DESCRIPTOR:
+ *     Building the HID descriptor.
+ *
+ * @IPTS_PHASE_IO:
+ *     Setting up the data flow from the ME to the host.
+ *
+ * @IPTS_PHASE_HID:
+ *     Creating the HID device.
+ */
+enum ipts_start_phase {
+	IPTS_PHASE_READY,
+	IPTS_PHASE_DEVICE_INFO,
+	IPTS_PHASE_RESOURCES,
+	IPTS_PHASE_DESCRIPTOR,
+	IPTS_PHASE_IO,
+	IPTS_PHASE_HID,
+	IPTS_PHASE_COUNT,
+};
+
 /**
  * struct ipts_context - Central place to store information about the state of the driver.
  *
@@ -48,6 +86,97 @@
  * @info:
  *     Information about the device we are driving.
  *
+ * @ready_time:
+ *     How long the touch sensor needed to become ready during the last start, in milliseconds.
+ *
+ * @start_time:
+ *     How long each phase of the last start took, in microseconds. See &enum ipts_start_phase.
+ *
+ * @control_lock:
+ *     Serializes operations that start, stop or reconfigure the driver, such as restarts,
+ *     mode switches, suspend / resume and recovery.
+ *
+ * @running:
+ *     Whether the driver is supposed to be running. This is set when the driver is started and
+ *     only cleared when it is stopped, so that a failed restart can be tried again.
+ *
+ * @suspended:
+ *     Whether the system is asleep. Work items must not touch the ME until it has resumed.
+ *
+ * @restart_work:
+ *     Tries to start the driver again after a restart has failed.
+ *
+ * @restart_delay:
+ *     How long was waited before the last attempt to restart, in milliseconds. This is 0 if the
+ *     last restart has succeeded.
+ *
+ * @recovering:
+ *     Whether the receiver has noticed a reset of the touch sensor. It will ignore incoming
+ *     data until the ME has been set up again.
+ *
+ * @reset_status:
+ *     The status with which the ME reported the last reset of the touch sensor.
+ *
+ * @reset_reason:
+ *     The reason the ME gave for the last reset. See &enum ipts_reset_reason.
+ *
+ * @recovery_work:
+ *     Sets up the ME again after the touch sensor was reset.
+ *
+ * @reset_work:
+ *     Resets the touch sensor on behalf of the receiver, for example if the doorbell stalled.
+ *
+ * @recovery_count:
+ *     How often the driver has recovered from a reset of the touch sensor.
+ *
+ * @recovery_time:
+ *     How long the last recovery took, in microseconds.
+ *
+ * @stall_start:
+ *     When the receiver noticed that the doorbell has stalled, or 0 if it is moving.
+ *
+ * @stall_level:
+ *     How far the receiver has escalated its attempts to get the doorbell moving again.
+ *
+ * @stall_count:
+ *     How often the doorbell has stalled.
+ *
+ * @stall_time:
+ *     How long it took until the last stall was resolved, in microseconds.
+ *
+ * @policy:
+ *     The policy that userspace has requested for the ME. See &struct ipts_policy.
+ *
+ * @policy_set:
+ *     Whether userspace has changed the policy. If not, the defaults of the ME are kept.
+ *
+ * @policy_lock:
+ *     Protects the requested policy.
+ *
+ * @spi_setting:
+ *     Which entry of the list of SPI settings is being used, if SPI negotiation is enabled.
+ *     Settings that turned out to be unreliable are skipped on the next start.
+ *
+ * @spi_errors:
+ *     How many broken buffers were seen since &ipts_context->spi_window started.
+ *
+ * @spi_window:
+ *     When the window in which broken buffers are counted has started.
+ *
+ * @spi_work:
+ *     Restarts the driver with slower SPI settings if the current ones are unreliable.
+ *
+ * @descriptor:
+ *     The HID descriptor of the device. Building it can require a round trip to the ME, so it is
+ *     cached and reused across restarts, as long as the device does not change.
+ *
+ * @descriptor_size:
+ *     The size of the cached HID descriptor.
+ *
+ * @descriptor_info:
+ *     The device info that was current when the cached HID descriptor was built. The cache is only
+ *     valid as long as vendor, product and firmware revision match &ipts_context->info.
+ *
  * @feature_lock:
  *     Prevents userspace from issuing multiple HID_GET_FEATURE requests at the same time.
  *
@@ -55,11 +184,69 @@
  *     The answer to a GET_FEATURE request is sent through a standard IPTS data buffer.
  *     Using this event, the HID interface can wait until the receiver thread has read it.
  *
+ * @feature_seq:
+ *     Incremented whenever a GET_FEATURE request has finished. Callers that had to wait for
+ *     feature_lock can use this to detect that a request was answered while they were waiting.
+ *
+ * @feature_valid:
+ *     Whether the feature buffer holds the successful answer to the last GET_FEATURE request.
+ *
+ * @feature_report:
+ *     The report ID of the answer in the feature buffer.
+ *
+ * @feature_expires:
+ *     Until when the answer in the feature buffer may be reused by new GET_FEATURE requests.
+ *
+ * @feature_writes:
+ *     Counts SET_FEATURE requests and output reports. An answer that was requested before a
+ *     write could be outdated and must not be reused anymore.
+ *
+ * @feature_cache_writes:
+ *     The value of feature_writes when the answer in the feature buffer was requested.
+ *
+ * @hid2me_lock:
+ *     There is only one HID2ME buffer. This prevents multiple threads from using it at once.
+ *
+ * @output_queue:
+ *     SET_FEATURE requests and output reports that are waiting to be sent to the ME.
+ *
+ * @output_pending:
+ *     How many entries are in the output queue.
+ *
+ * @output_lock:
+ *     Protects the output queue.
+ *
+ * @output_work:
+ *     Sends the contents of the output queue to the ME, so that writers don't have to wait.
+ *
+ * @sensor_idle:
+ *     Whether the touch sensor has been put to sleep because the HID device is not in use.
+ *
+ * @sleep_delay:
+ *     How long the HID device must be unused before the touch sensor is put to sleep, in
+ *     milliseconds. If this is 0, the sensor is never put to sleep.
+ *
+ * @sleep_work:
+ *     Puts the touch sensor to sleep once the HID device has been unused for long enough.
+ *
  * @hid_active:
  *     Whether the HID interface should be accepting requests from userspace at the moment.
  *
+ * @hid_opened:
+ *     Whether the HID device has been opened by at least one consumer. If nobody is listening,
+ *     incoming data does not need to be forwarded to the HID core.
+ *
+ * @data_requested:
+ *     When the driver last asked the ME for data in event mode.
+ *
  * @hid:
  *     The linux HID device object.
+ *
+ * @stats:
+ *     Counters for the data path, one copy per CPU. See &struct ipts_stats.
+ *
+ * @debugfs:
+ *     The debugfs directory of the device.
  */
 struct ipts_context {
 	struct device *dev;
@@ -72,12 +259,70 @@ struct ipts_context {
 	u8 buffers;
 	enum ipts_mode mode;
 	struct ipts_rsp_get_device_info info;
+	u32 ready_time;
+	u32 start_time[IPTS_PHASE_COUNT];
+
+	struct mutex control_lock;
+
+	bool running;
+	bool suspended;
+	struct delayed_work restart_work;
+	unsigned int restart_delay;
+
+	bool recovering;
+	int reset_status;
+	u8 reset_reason;
+	struct work_struct recovery_work;
+	struct work_struct reset_work;
+	u32 recovery_count;
+	u32 recovery_time;
+
+	ktime_t stall_start;
+	int stall_level;
+	u32 stall_count;
+	u32 stall_time;
+
+	struct ipts_policy policy;
+	bool policy_set;
+	struct mutex policy_lock;
+
+	u8 spi_setting;
+	atomic_t spi_errors;
+	ktime_t spi_window;
+	struct work_struct spi_work;
+
+	u8 *descriptor;
+	size_t descriptor_size;
+	struct ipts_rsp_get_device_info descriptor_info;
 
 	struct mutex feature_lock;
 	struct completion feature_event;
 
+	u32 feature_seq;
+	bool feature_valid;
+	u8 feature_report;
+	unsigned long feature_expires;
+	atomic_t feature_writes;
+	int feature_cache_writes;
+
+	struct mutex hid2me_lock;
+
+	struct list_head output_queue;
+	size_t output_pending;
+	spinlock_t output_lock;
+	struct work_struct output_work;
+
+	bool sensor_idle;
+	unsigned int sleep_delay;
+	struct delayed_work sleep_work;
+
 	bool hid_active;
+	bool hid_opened;
 	struct hid_device *hid;
+
+	ktime_t data_requested;
+	struct ipts_stats __percpu *stats;
+	struct dentry *debugfs;
 };
 
 #endif /* IPTS_CONTEXT_H */
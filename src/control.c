@@ -10,34 +10,124 @@
 #include <linux/errno.h>
 #include <linux/kernel.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/lockdep.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/time64.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "context.h"
 #include "control.h"
+#include "eds1.h"
+#include "eds2.h"
 #include "hid.h"
 #include "mei.h"
 #include "receiver.h"
 #include "resources.h"
 #include "spec-dma.h"
 #include "spec-mei.h"
+#include "spi.h"
+#include "stats.h"
+#include "trace.h"
 
+/**
+ * READY_TIMEOUT - How long to wait for the touch sensor to become ready, in milliseconds.
+ */
+#define READY_TIMEOUT (5 * MSEC_PER_SEC)
+
+/**
+ * READY_DELAY_MIN - The initial delay before asking a sensor that is not ready again, in ms.
+ */
+#define READY_DELAY_MIN 10
+
+/**
+ * READY_DELAY_MAX - The maximum delay before asking a sensor that is not ready again, in ms.
+ */
+#define READY_DELAY_MAX 200
+
+/**
+ * RESTART_DELAY_MIN - How long to wait before trying again after a restart failed, in ms.
+ */
+#define RESTART_DELAY_MIN (1 * MSEC_PER_SEC)
+
+/**
+ * RESTART_DELAY_MAX - The maximum delay between two attempts to restart, in ms.
+ */
+#define RESTART_DELAY_MAX (60 * MSEC_PER_SEC)
+
+/**
+ * ipts_control_notify_dev_ready() - Wait until the touch sensor is ready.
+ *
+ * The ME answers %IPTS_CMD_NOTIFY_DEV_READY once it has found the touch sensor. If the sensor
+ * is not ready yet (for example, because it is still shutting down after a restart), the command
+ * is repeated with an increasing delay, until it succeeds or %READY_TIMEOUT has passed.
+ *
+ * The time the sensor needed is stored in &ipts_context->ready_time.
+ *
+ * @ipts:
+ *     The IPTS driver context.
+ *
+ * Returns: 0 on success, <0 on error, >0 on ME error.
+ */
 static int ipts_control_notify_dev_ready(struct ipts_context *ipts)
 {
 	int ret = 0;
-	struct ipts_response rsp = { 0 };
+	bool pending = false;
+	unsigned int delay = READY_DELAY_MIN;
 
-	ret = ipts_mei_send(&ipts->mei, IPTS_CMD_NOTIFY_DEV_READY, NULL, 0);
-	if (ret)
-		return ret;
+	ktime_t start = ktime_get();
 
-	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_NOTIFY_DEV_READY, &rsp);
-	if (ret)
-		return ret;
+	/*
+	 * Don't mistake a late answer to an earlier, abandoned attempt for the answer to this one.
+	 */
+	ipts_mei_flush(&ipts->mei, IPTS_CMD_NOTIFY_DEV_READY);
 
-	return rsp.status;
+	while (true) {
+		struct ipts_response rsp = { 0 };
+
+		/*
+		 * Only send a new request once the ME has answered the last one.
+		 */
+		if (!pending) {
+			ret = ipts_mei_send(&ipts->mei, IPTS_CMD_NOTIFY_DEV_READY, NULL, 0);
+			if (ret)
+				return ret;
+
+			pending = true;
+		}
+
+		ret = ipts_mei_recv_timeout(&ipts->mei, IPTS_CMD_NOTIFY_DEV_READY, &rsp, delay);
+		if (ret == 0) {
+			pending = false;
+			ret = rsp.status;
+		}
+
+		if (ret == 0)
+			break;
+
+		if (ktime_ms_delta(ktime_get(), start) >= READY_TIMEOUT) {
+			if (pending)
+				ipts_stats_inc(ipts->stats, IPTS_STAT_TIMEOUTS);
+
+			ipts_mei_flush(&ipts->mei, IPTS_CMD_NOTIFY_DEV_READY);
+			return ret;
+		}
+
+		if (!pending)
+			msleep(delay);
+
+		delay = min_t(unsigned int, delay * 2, READY_DELAY_MAX);
+	}
+
+	WRITE_ONCE(ipts->ready_time, ktime_ms_delta(ktime_get(), start));
+	dev_dbg(ipts->dev, "Touch sensor was ready after %u ms\n", ipts->ready_time);
+
+	return 0;
 }
 
-static int ipts_control_get_device_info(struct ipts_context *ipts)
+int ipts_control_get_device_info(struct ipts_context *ipts)
 {
 	int ret = 0;
 	struct ipts_response rsp = { 0 };
@@ -107,6 +197,14 @@ static int ipts_control_set_mem_window(struct ipts_context *ipts)
 		dma_addr_t wq_addr = ipts->resources.workqueue.dma_address;
 		dma_addr_t db_addr = ipts->resources.doorbell.dma_address;
 
+		/*
+		 * The buffers are kept when the data flow is set up again, but a new receiver
+		 * starts counting at 0. The doorbell must not carry over the old count, or the
+		 * receiver would process stale buffers until it has caught up.
+		 */
+		memset(ipts->resources.workqueue.address, 0, ipts->resources.workqueue.size);
+		memset(ipts->resources.doorbell.address, 0, ipts->resources.doorbell.size);
+
 		cmd.tail_offset_addr_lower = lower_32_bits(wq_addr);
 		cmd.tail_offset_addr_lower = upper_32_bits(wq_addr);
 
@@ -133,21 +231,52 @@ static int ipts_control_set_mem_window(struct ipts_context *ipts)
 	return rsp.status;
 }
 
-static int ipts_control_get_descriptor(struct ipts_context *ipts)
+static bool ipts_control_descriptor_cached(struct ipts_context *ipts)
 {
-	int ret = 0;
+	if (!ipts->descriptor)
+		return false;
+
+	if (ipts->descriptor_info.vendor != ipts->info.vendor)
+		return false;
+
+	if (ipts->descriptor_info.product != ipts->info.product)
+		return false;
 
+	return ipts->descriptor_info.fw_rev == ipts->info.fw_rev;
+}
+
+/**
+ * ipts_control_request_descriptor() - Ask the ME for the native HID descriptor.
+ *
+ * This only sends the request. The ME can work on it while the driver does something else,
+ * the answer is collected by ipts_control_get_descriptor().
+ *
+ * EDS v1 devices don't support this command, and if the descriptor is cached already,
+ * there is no need to send it.
+ *
+ * @ipts:
+ *     The IPTS driver context.
+ *
+ * Returns: 0 on success, negative errno code on error.
+ */
+static int ipts_control_request_descriptor(struct ipts_context *ipts)
+{
+	int ret = 0;
 	struct ipts_cmd_get_hid_desc cmd = { 0 };
-	struct ipts_response rsp = { 0 };
 
-	/*
-	 * This command is only supported on EDS v2 devices.
-	 *
-	 * EDS v1 devices without native HID support will use a fallback HID descriptor.
-	 */
 	if (ipts->eds_intf_rev == 1)
 		return 0;
 
+	if (ipts_control_descriptor_cached(ipts))
+		return 0;
+
+	/*
+	 * The buffer for this is only needed until the descriptor has been copied into the cache.
+	 */
+	ret = ipts_resources_alloc_descriptor(&ipts->resources, ipts->dev, ipts->info);
+	if (ret)
+		return ret;
+
 	memset(ipts->resources.descriptor.address, 0, ipts->resources.descriptor.size);
 
 	cmd.addr_lower = lower_32_bits(ipts->resources.descriptor.dma_address);
@@ -155,10 +284,128 @@ static int ipts_control_get_descriptor(struct ipts_context *ipts)
 	cmd.magic = 8;
 
 	ret = ipts_mei_send(&ipts->mei, IPTS_CMD_GET_HID_DESC, &cmd, sizeof(cmd));
+	if (ret)
+		ipts_resources_free_descriptor(&ipts->resources);
+
+	return ret;
+}
+
+/**
+ * ipts_control_get_descriptor() - Build the HID descriptor and store it in the cache.
+ *
+ * On EDS v2 devices, this waits for the answer to ipts_control_request_descriptor().
+ * EDS v1 devices without native HID support will use a fallback HID descriptor.
+ *
+ * @ipts:
+ *     The IPTS driver context.
+ *
+ * Returns: 0 on success, <0 on error, >0 on ME error.
+ */
+static int ipts_control_get_descriptor(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	u8 *buffer = NULL;
+	size_t size = 0;
+
+	struct ipts_response rsp = { 0 };
+
+	if (ipts_control_descriptor_cached(ipts))
+		return 0;
+
+	if (ipts->eds_intf_rev == 1) {
+		ret = ipts_eds1_get_descriptor(ipts, &buffer, &size);
+		if (ret)
+			return ret;
+	} else {
+		ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_GET_HID_DESC, &rsp);
+		if (ret)
+			return ret;
+
+		/*
+		 * Once the ME has answered, it won't write to the buffer anymore.
+		 */
+		if (rsp.status == IPTS_STATUS_SUCCESS)
+			ret = ipts_eds2_get_descriptor(ipts, &buffer, &size);
+
+		ipts_resources_free_descriptor(&ipts->resources);
+
+		if (rsp.status != IPTS_STATUS_SUCCESS)
+			return rsp.status;
+
+		if (ret)
+			return ret;
+	}
+
+	kfree(ipts->descriptor);
+
+	ipts->descriptor = buffer;
+	ipts->descriptor_size = size;
+	ipts->descriptor_info = ipts->info;
+
+	return 0;
+}
+
+int ipts_control_get_policy(struct ipts_context *ipts, struct ipts_policy *policy)
+{
+	int ret = 0;
+	struct ipts_response rsp = { 0 };
+
+	lockdep_assert_held(&ipts->policy_lock);
+
+	ret = ipts_mei_send(&ipts->mei, IPTS_CMD_GET_POLICY, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_GET_POLICY, &rsp);
+	if (ret)
+		return ret;
+
+	if (rsp.status == IPTS_STATUS_SUCCESS)
+		*policy = rsp.payload.get_policy.policy;
+
+	return rsp.status;
+}
+
+int ipts_control_set_policy(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	struct ipts_cmd_set_policy cmd = { 0 };
+	struct ipts_response rsp = { 0 };
+
+	lockdep_assert_held(&ipts->policy_lock);
+
+	if (!ipts->policy_set)
+		return 0;
+
+	cmd.policy = ipts->policy;
+
+	ret = ipts_mei_send(&ipts->mei, IPTS_CMD_SET_POLICY, &cmd, sizeof(cmd));
+	if (ret)
+		return ret;
+
+	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_SET_POLICY, &rsp);
 	if (ret)
 		return ret;
 
-	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_GET_HID_DESC, &rsp);
+	return rsp.status;
+}
+
+int ipts_control_reset_sensor(struct ipts_context *ipts, enum ipts_reset_type type)
+{
+	int ret = 0;
+
+	struct ipts_cmd_reset_sensor cmd = { 0 };
+	struct ipts_response rsp = { 0 };
+
+	cmd.type = type;
+
+	ret = ipts_mei_send(&ipts->mei, IPTS_CMD_RESET_SENSOR, &cmd, sizeof(cmd));
+	if (ret)
+		return ret;
+
+	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_RESET_SENSOR, &rsp);
 	if (ret)
 		return ret;
 
@@ -186,34 +433,53 @@ int ipts_control_wait_flush(struct ipts_context *ipts)
 
 int ipts_control_request_data(struct ipts_context *ipts)
 {
+	ipts->data_requested = ktime_get();
 	return ipts_mei_send(&ipts->mei, IPTS_CMD_READY_FOR_DATA, NULL, 0);
 }
 
-int ipts_control_wait_data(struct ipts_context *ipts, struct ipts_rsp_ready_for_data *response)
+static int ipts_control_wait_data_timeout(struct ipts_context *ipts,
+					  struct ipts_rsp_ready_for_data *response, u64 timeout)
 {
 	int ret = 0;
 	struct ipts_response rsp = { 0 };
 
-	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_READY_FOR_DATA, &rsp);
+	ret = ipts_mei_recv_timeout(&ipts->mei, IPTS_CMD_READY_FOR_DATA, &rsp, timeout);
 	if (ret)
 		return ret;
 
 	/*
 	 * During shutdown, it is possible that the sensor has already been disabled.
 	 */
-	if (rsp.status == IPTS_STATUS_SENSOR_DISABLED)
+	if (rsp.status == IPTS_STATUS_SENSOR_DISABLED && !response)
 		return 0;
 
-	if (rsp.status == IPTS_STATUS_SUCCESS && response)
+	/*
+	 * If the sensor was reset, the response contains the reason for it.
+	 */
+	if (response)
 		*response = rsp.payload.ready_for_data;
 
+	if (response && rsp.status == IPTS_STATUS_SUCCESS)
+		ipts_stats_latency(ipts->stats, IPTS_LATENCY_READY_FOR_DATA, ipts->data_requested);
+
 	return rsp.status;
 }
 
+int ipts_control_wait_data(struct ipts_context *ipts, struct ipts_rsp_ready_for_data *response)
+{
+	return ipts_control_wait_data_timeout(ipts, response, 1 * MSEC_PER_SEC);
+}
+
+int ipts_control_check_data(struct ipts_context *ipts, struct ipts_rsp_ready_for_data *response)
+{
+	return ipts_control_wait_data_timeout(ipts, response, 0);
+}
+
 int ipts_control_refill_buffer(struct ipts_context *ipts, struct ipts_data_buffer *buffer)
 {
 	int ret = 0;
 	size_t index = buffer->total_index % ipts->buffers;
+	ktime_t start = 0;
 
 	struct ipts_feedback_buffer *feedback =
 		(struct ipts_feedback_buffer *)ipts->resources.feedback[index].address;
@@ -244,18 +510,30 @@ int ipts_control_refill_buffer(struct ipts_context *ipts, struct ipts_data_buffe
 		feedback->protocol_ver = buffer->protocol_ver;
 	}
 
+	trace_ipts_feedback(index, buffer->total_index, buffer->transaction);
+	start = ktime_get();
+
 	ret = ipts_mei_send(&ipts->mei, IPTS_CMD_FEEDBACK, &cmd, sizeof(cmd));
 	if (ret)
-		return ret;
+		goto err;
 
-	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_FEEDBACK, &rsp);
+	ret = ipts_mei_recv_feedback(&ipts->mei, index, &rsp);
 	if (ret)
-		return ret;
+		goto err;
+
+	trace_ipts_feedback_done(index, buffer->transaction, rsp.status);
+	ipts_stats_latency(ipts->stats, IPTS_LATENCY_FEEDBACK, start);
 
 	if (ipts->eds_intf_rev > 1 && rsp.status == IPTS_STATUS_INVALID_PARAMS)
 		return 0;
 
-	return rsp.status;
+	ret = rsp.status;
+	if (!ret)
+		return 0;
+
+err:
+	ipts_stats_inc(ipts->stats, IPTS_STAT_REFILL_ERRORS);
+	return ret;
 }
 
 int ipts_control_hid2me_feedback(struct ipts_context *ipts, enum ipts_feedback_cmd_type cmd_type,
@@ -267,6 +545,22 @@ int ipts_control_hid2me_feedback(struct ipts_context *ipts, enum ipts_feedback_c
 	struct ipts_cmd_feedback cmd = { 0 };
 	struct ipts_response rsp = { 0 };
 
+	mutex_lock(&ipts->hid2me_lock);
+
+	/*
+	 * The buffer is freed under this lock when the driver is stopped, after the HID interface
+	 * has been shut down. Callers that checked hid_active before could be racing with that.
+	 */
+	if (!READ_ONCE(ipts->hid_active)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (size + sizeof(*buffer) > ipts->resources.hid2me.size) {
+		ret = -EINVAL;
+		goto out;
+	}
+
 	memset(ipts->resources.hid2me.address, 0, ipts->resources.hid2me.size);
 	buffer = (struct ipts_feedback_buffer *)ipts->resources.hid2me.address;
 
@@ -275,9 +569,6 @@ int ipts_control_hid2me_feedback(struct ipts_context *ipts, enum ipts_feedback_c
 	buffer->size = size;
 	buffer->total_index = IPTS_HID_2_ME_BUFFER_INDEX;
 
-	if (size + sizeof(*buffer) > ipts->resources.hid2me.size)
-		return -EINVAL;
-
 	if (data && size > 0)
 		memcpy(buffer->data, data, size);
 
@@ -286,18 +577,138 @@ int ipts_control_hid2me_feedback(struct ipts_context *ipts, enum ipts_feedback_c
 
 	ret = ipts_mei_send(&ipts->mei, IPTS_CMD_FEEDBACK, &cmd, sizeof(cmd));
 	if (ret)
-		return ret;
+		goto out;
 
-	ret = ipts_mei_recv(&ipts->mei, IPTS_CMD_FEEDBACK, &rsp);
+	ret = ipts_mei_recv_feedback(&ipts->mei, IPTS_HID_2_ME_BUFFER_INDEX, &rsp);
 	if (ret)
+		goto out;
+
+	ret = rsp.status;
+
+out:
+	mutex_unlock(&ipts->hid2me_lock);
+	return ret;
+}
+
+static bool ipts_control_has_buffers(struct ipts_context *ipts)
+{
+	return ipts->resources.doorbell.address;
+}
+
+/**
+ * ipts_control_start_io() - Set up the data flow from the ME to the host.
+ *
+ * This only requires the buffers to be allocated. It can be repeated after the data flow has
+ * been stopped with ipts_receiver_stop(), without having to go through the full start sequence.
+ *
+ * @ipts:
+ *     The IPTS driver context.
+ *
+ * Returns: 0 on success, <0 on error, >0 on ME error.
+ */
+static int ipts_control_start_io(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	/*
+	 * If an earlier restart has failed, the buffers are gone. Only a full start can help then.
+	 */
+	if (!ipts_control_has_buffers(ipts))
+		return -ENODEV;
+
+	ret = ipts_control_set_mode(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to set mode: %d\n", ret);
 		return ret;
+	}
 
-	return rsp.status;
+	/*
+	 * From now on, the ME is set up again, so the receiver can handle new resets.
+	 */
+	WRITE_ONCE(ipts->recovering, false);
+
+	ret = ipts_control_set_mem_window(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to set memory window: %d\n", ret);
+		return ret;
+	}
+
+	ret = ipts_receiver_start(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to start receiver: %d\n", ret);
+		return ret;
+	}
+
+	ret = ipts_control_request_data(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to request data: %d\n", ret);
+		return ret;
+	}
+
+	return 0;
 }
 
-int ipts_control_start(struct ipts_context *ipts)
+static void ipts_control_phase_done(struct ipts_context *ipts, enum ipts_start_phase phase,
+				    ktime_t *start)
+{
+	ktime_t now = ktime_get();
+
+	WRITE_ONCE(ipts->start_time[phase], ktime_us_delta(now, *start));
+	*start = now;
+}
+
+/**
+ * ipts_control_set_sensor_state() - Change the power state of the touch sensor.
+ *
+ * The sensor can execute commands that are sent to it through feedback. Outside of the
+ * normal data flow, this requires HID2ME feedback, which is only supported on EDS v2 devices.
+ *
+ * @ipts:
+ *     The IPTS driver context.
+ *
+ * @state:
+ *     The command that switches the sensor into the desired state, for example
+ *     %IPTS_FEEDBACK_CMD_TYPE_GOTO_SLEEP or %IPTS_FEEDBACK_CMD_TYPE_GOTO_SENSING.
+ *
+ * Returns: 0 on success, <0 on error, >0 on ME error.
+ */
+static int ipts_control_set_sensor_state(struct ipts_context *ipts,
+					 enum ipts_feedback_cmd_type state)
+{
+	if (ipts->eds_intf_rev == 1)
+		return -EOPNOTSUPP;
+
+	if (!READ_ONCE(ipts->hid_active))
+		return -ENODEV;
+
+	return ipts_control_hid2me_feedback(ipts, state, IPTS_FEEDBACK_DATA_TYPE_VENDOR, NULL, 0);
+}
+
+/*
+ * If userspace has changed the policy of the ME, restore it, and apply the negotiated SPI
+ * settings again. The ME might have forgotten about them if the sensor was reset or the system
+ * was asleep. Failing to do so is not fatal, the sensor will just run with its defaults.
+ */
+static void ipts_control_restore_settings(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	mutex_lock(&ipts->policy_lock);
+	ret = ipts_control_set_policy(ipts);
+	mutex_unlock(&ipts->policy_lock);
+
+	if (ret)
+		dev_warn(ipts->dev, "Failed to set policy: %d\n", ret);
+
+	ret = ipts_spi_negotiate(ipts);
+	if (ret)
+		dev_warn(ipts->dev, "Failed to negotiate SPI settings: %d\n", ret);
+}
+
+static int _ipts_control_start(struct ipts_context *ipts)
 {
 	int ret = 0;
+	ktime_t start = ktime_get();
 
 	dev_info(ipts->dev, "Starting IPTS\n");
 
@@ -307,12 +718,17 @@ int ipts_control_start(struct ipts_context *ipts)
 		return ret;
 	}
 
+	ipts_control_phase_done(ipts, IPTS_PHASE_READY, &start);
+
 	ret = ipts_control_get_device_info(ipts);
 	if (ret) {
 		dev_err(ipts->dev, "Failed to get device info: %d\n", ret);
 		return ret;
 	}
 
+	ipts_control_restore_settings(ipts);
+	ipts_control_phase_done(ipts, IPTS_PHASE_DEVICE_INFO, &start);
+
 	dev_dbg(ipts->dev, "IPTS Device Info:\n");
 	dev_dbg(ipts->dev, "vendor = %04X\n", ipts->info.vendor);
 	dev_dbg(ipts->dev, "product = %04X\n", ipts->info.product);
@@ -343,41 +759,42 @@ int ipts_control_start(struct ipts_context *ipts)
 	if (ipts->eds_intf_rev > 1)
 		ipts->mode = IPTS_MODE_POLL;
 
-	ret = ipts_resources_init(&ipts->resources, ipts->dev, ipts->info);
+	/*
+	 * Fetching the HID descriptor does not depend on the data buffers, so the ME can already
+	 * work on it while they are being allocated.
+	 */
+	ret = ipts_control_request_descriptor(ipts);
 	if (ret) {
-		dev_err(ipts->dev, "Failed to allocate buffers: %d", ret);
+		dev_err(ipts->dev, "Failed to request HID descriptor: %d\n", ret);
 		return ret;
 	}
 
-	ret = ipts_control_get_descriptor(ipts);
+	ret = ipts_resources_init(&ipts->resources, ipts->dev, ipts->info);
 	if (ret) {
-		dev_err(ipts->dev, "Failed to fetch HID descriptor: %d\n", ret);
-		return ret;
-	}
+		dev_err(ipts->dev, "Failed to allocate buffers: %d", ret);
 
-	ret = ipts_control_set_mode(ipts);
-	if (ret) {
-		dev_err(ipts->dev, "Failed to set mode: %d\n", ret);
+		/*
+		 * Don't leave the ME writing into the descriptor buffer after we are gone.
+		 */
+		ipts_control_get_descriptor(ipts);
 		return ret;
 	}
 
-	ret = ipts_control_set_mem_window(ipts);
-	if (ret) {
-		dev_err(ipts->dev, "Failed to set memory window: %d\n", ret);
-		return ret;
-	}
+	ipts_control_phase_done(ipts, IPTS_PHASE_RESOURCES, &start);
 
-	ret = ipts_receiver_start(ipts);
+	ret = ipts_control_get_descriptor(ipts);
 	if (ret) {
-		dev_err(ipts->dev, "Failed to start receiver: %d\n", ret);
+		dev_err(ipts->dev, "Failed to fetch HID descriptor: %d\n", ret);
 		return ret;
 	}
 
-	ret = ipts_control_request_data(ipts);
-	if (ret) {
-		dev_err(ipts->dev, "Failed to request data: %d\n", ret);
+	ipts_control_phase_done(ipts, IPTS_PHASE_DESCRIPTOR, &start);
+
+	ret = ipts_control_start_io(ipts);
+	if (ret)
 		return ret;
-	}
+
+	ipts_control_phase_done(ipts, IPTS_PHASE_IO, &start);
 
 	ipts_hid_enable(ipts);
 
@@ -387,6 +804,16 @@ int ipts_control_start(struct ipts_context *ipts)
 		return ret;
 	}
 
+	ipts_control_phase_done(ipts, IPTS_PHASE_HID, &start);
+
+	dev_dbg(ipts->dev, "IPTS Start Timings (us):\n");
+	dev_dbg(ipts->dev, "ready = %u\n", ipts->start_time[IPTS_PHASE_READY]);
+	dev_dbg(ipts->dev, "device_info = %u\n", ipts->start_time[IPTS_PHASE_DEVICE_INFO]);
+	dev_dbg(ipts->dev, "resources = %u\n", ipts->start_time[IPTS_PHASE_RESOURCES]);
+	dev_dbg(ipts->dev, "descriptor = %u\n", ipts->start_time[IPTS_PHASE_DESCRIPTOR]);
+	dev_dbg(ipts->dev, "io = %u\n", ipts->start_time[IPTS_PHASE_IO]);
+	dev_dbg(ipts->dev, "hid = %u\n", ipts->start_time[IPTS_PHASE_HID]);
+
 	return 0;
 }
 
@@ -394,7 +821,12 @@ static int _ipts_control_stop(struct ipts_context *ipts)
 {
 	int ret = 0;
 
-	ipts_hid_disable(ipts);
+	/*
+	 * Send out all reports that userspace has written so far, while the ME is still running.
+	 */
+	ipts_eds2_flush_output(ipts);
+
+	ipts_hid_disable(ipts);
 	dev_info(ipts->dev, "Stopping IPTS\n");
 
 	ret = ipts_receiver_stop(ipts);
@@ -403,15 +835,104 @@ static int _ipts_control_stop(struct ipts_context *ipts)
 		return ret;
 	}
 
+	/*
+	 * Sleep, wake and the output queue can send HID2ME feedback without holding control_lock.
+	 */
+	mutex_lock(&ipts->hid2me_lock);
 	ipts_resources_free(&ipts->resources);
+	mutex_unlock(&ipts->hid2me_lock);
+
+	ipts_resources_free_descriptor(&ipts->resources);
+
+	return 0;
+}
+
+/*
+ * A failed restart leaves the driver stopped. Instead of leaving touch dead until the driver is
+ * bound again, keep trying in the background, with an increasing delay between attempts.
+ */
+/*
+ * Work items and requests from userspace may only change the state of the driver while it is
+ * running and not suspended.
+ */
+static bool ipts_control_active(struct ipts_context *ipts)
+{
+	lockdep_assert_held(&ipts->control_lock);
+
+	return ipts->running && !ipts->suspended;
+}
+
+static void ipts_control_schedule_restart(struct ipts_context *ipts)
+{
+	ipts->restart_delay = clamp_t(unsigned int, ipts->restart_delay * 2, RESTART_DELAY_MIN,
+				      RESTART_DELAY_MAX);
+
+	dev_info(ipts->dev, "Trying to restart again in %u ms\n", ipts->restart_delay);
+	schedule_delayed_work(&ipts->restart_work, msecs_to_jiffies(ipts->restart_delay));
+}
+
+static int _ipts_control_restart(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	ret = _ipts_control_stop(ipts);
+	if (ret)
+		return ret;
+
+	/*
+	 * Starting will wait until the sensor has fully shut down and is ready again.
+	 */
+	ret = _ipts_control_start(ipts);
+	if (ret) {
+		ipts_control_schedule_restart(ipts);
+		return ret;
+	}
+
+	ipts->restart_delay = 0;
 	return 0;
 }
 
+/*
+ * The receiver can schedule work that restarts the driver until it has been stopped. The work
+ * items take control_lock, so this must not be called while holding it.
+ */
+static void ipts_control_cancel_work(struct ipts_context *ipts)
+{
+	cancel_work_sync(&ipts->spi_work);
+	cancel_work_sync(&ipts->recovery_work);
+	cancel_work_sync(&ipts->reset_work);
+	cancel_delayed_work_sync(&ipts->restart_work);
+	cancel_delayed_work_sync(&ipts->sleep_work);
+}
+
+int ipts_control_start(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	mutex_lock(&ipts->control_lock);
+	ipts->running = true;
+	ret = _ipts_control_start(ipts);
+	mutex_unlock(&ipts->control_lock);
+
+	return ret;
+}
+
 int ipts_control_stop(struct ipts_context *ipts)
 {
 	int ret = 0;
 
+	ipts_control_cancel_work(ipts);
+
+	mutex_lock(&ipts->control_lock);
+	ipts->running = false;
 	ret = _ipts_control_stop(ipts);
+	mutex_unlock(&ipts->control_lock);
+
+	/*
+	 * Work that was scheduled while stopping sees that the driver is stopped and does nothing.
+	 */
+	ipts_control_cancel_work(ipts);
+
 	if (ret)
 		return ret;
 
@@ -421,6 +942,15 @@ int ipts_control_stop(struct ipts_context *ipts)
 		return ret;
 	}
 
+	/*
+	 * Drop anything that was written while the driver was shutting down.
+	 */
+	ipts_eds2_flush_output(ipts);
+
+	kfree(ipts->descriptor);
+	ipts->descriptor = NULL;
+	ipts->descriptor_size = 0;
+
 	return 0;
 }
 
@@ -428,18 +958,434 @@ int ipts_control_restart(struct ipts_context *ipts)
 {
 	int ret = 0;
 
-	ret = _ipts_control_stop(ipts);
+	mutex_lock(&ipts->control_lock);
+
+	/*
+	 * Don't bring the driver back up if it was stopped or suspended in the meantime.
+	 */
+	if (ipts_control_active(ipts))
+		ret = _ipts_control_restart(ipts);
+	else
+		ret = -ENODEV;
+
+	mutex_unlock(&ipts->control_lock);
+
+	return ret;
+}
+
+void ipts_control_restart_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct ipts_context *ipts = container_of(work, struct ipts_context, restart_work.work);
+
+	mutex_lock(&ipts->control_lock);
+
+	/*
+	 * If the driver was stopped or suspended in the meantime, or another restart has succeeded,
+	 * there is nothing left to do.
+	 */
+	if (ipts_control_active(ipts) && ipts->restart_delay) {
+		ret = _ipts_control_restart(ipts);
+		if (ret)
+			dev_err(ipts->dev, "Failed to restart IPTS: %d\n", ret);
+	}
+
+	mutex_unlock(&ipts->control_lock);
+}
+
+static int _ipts_control_switch_mode(struct ipts_context *ipts, enum ipts_mode mode)
+{
+	int ret = 0;
+
+	if (ipts->mode == mode)
+		return 0;
+
+	dev_info(ipts->dev, "Switching IPTS to %s mode\n",
+		 mode == IPTS_MODE_POLL ? "poll" : "event");
+
+	/*
+	 * Quiescing IO keeps the buffer addresses, and both modes use the same buffers. The HID
+	 * device and all DMA memory can stay as they are, only the data flow has to be set up again.
+	 */
+	ret = ipts_receiver_stop(ipts);
 	if (ret)
 		return ret;
 
+	ipts->mode = mode;
+
+	ret = ipts_control_start_io(ipts);
+	if (ret)
+		return ret;
+
+	return 0;
+}
+
+int ipts_control_switch_mode(struct ipts_context *ipts, enum ipts_mode mode)
+{
+	int ret = 0;
+
+	mutex_lock(&ipts->control_lock);
+	ret = _ipts_control_switch_mode(ipts, mode);
+	mutex_unlock(&ipts->control_lock);
+
+	return ret;
+}
+
+static int _ipts_control_suspend(struct ipts_context *ipts)
+{
+	int ret = 0;
+
 	/*
-	 * Wait a second to give the sensor time to fully shut down.
+	 * Send out all reports that userspace has written so far, while the ME is still running.
 	 */
-	msleep(1000);
+	ipts_eds2_flush_output(ipts);
 
-	ret = ipts_control_start(ipts);
-	if (ret)
+	ipts_hid_disable(ipts);
+	dev_info(ipts->dev, "Suspending IPTS\n");
+
+	/*
+	 * Only the data flow is stopped. The buffers and the HID device are kept, so that the
+	 * driver can pick up where it left off on resume.
+	 */
+	ret = ipts_receiver_stop(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to stop receiver: %d\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int ipts_control_suspend(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	ipts_control_cancel_work(ipts);
+
+	mutex_lock(&ipts->control_lock);
+
+	ret = _ipts_control_suspend(ipts);
+	if (!ret)
+		ipts->suspended = true;
+
+	mutex_unlock(&ipts->control_lock);
+
+	/*
+	 * Work that was scheduled while suspending sees that the driver is suspended and does
+	 * nothing.
+	 */
+	ipts_control_cancel_work(ipts);
+
+	return ret;
+}
+
+static int _ipts_control_resume(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	dev_info(ipts->dev, "Resuming IPTS\n");
+
+	/*
+	 * If an earlier restart has failed, the buffers are gone and there is nothing to resume.
+	 */
+	if (!ipts_control_has_buffers(ipts))
+		goto restart;
+
+	ipts_hid_enable(ipts);
+	ipts_control_restore_settings(ipts);
+
+	ret = ipts_control_start_io(ipts);
+	if (!ret)
+		return 0;
+
+	/*
+	 * If the ME has lost its state while the system was asleep, start over.
+	 */
+	dev_warn(ipts->dev, "Failed to resume in place, restarting: %d\n", ret);
+
+restart:
+	ret = _ipts_control_restart(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to restart IPTS: %d\n", ret);
 		return ret;
+	}
 
 	return 0;
 }
+
+int ipts_control_resume(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	mutex_lock(&ipts->control_lock);
+	ipts->suspended = false;
+	ret = _ipts_control_resume(ipts);
+	mutex_unlock(&ipts->control_lock);
+
+	return ret;
+}
+
+void ipts_control_schedule_recovery(struct ipts_context *ipts, int status, u8 reason)
+{
+	/*
+	 * Until recovery has set up the ME again, all following errors are caused by the same reset.
+	 */
+	if (READ_ONCE(ipts->recovering))
+		return;
+
+	ipts->reset_status = status;
+	ipts->reset_reason = reason;
+
+	WRITE_ONCE(ipts->recovering, true);
+	schedule_work(&ipts->recovery_work);
+}
+
+/*
+ * After the touch sensor was reset, answers to requests from before the reset are stale.
+ */
+static void ipts_control_flush_messages(struct ipts_context *ipts)
+{
+	ipts_mei_flush(&ipts->mei, IPTS_CMD_READY_FOR_DATA);
+
+	mutex_lock(&ipts->hid2me_lock);
+	ipts_mei_flush(&ipts->mei, IPTS_CMD_FEEDBACK);
+	mutex_unlock(&ipts->hid2me_lock);
+}
+
+static int _ipts_control_reset(struct ipts_context *ipts, enum ipts_reset_type type)
+{
+	int ret = 0;
+
+	/*
+	 * Only the data flow is stopped. The buffers and the HID device stay as they are.
+	 */
+	ret = ipts_receiver_stop(ipts);
+	if (ret)
+		return ret;
+
+	ret = ipts_control_reset_sensor(ipts, type);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to reset touch sensor: %d\n", ret);
+		return ret;
+	}
+
+	ipts_control_flush_messages(ipts);
+
+	ret = ipts_control_notify_dev_ready(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Touch sensor did not come back from reset: %d\n", ret);
+		return ret;
+	}
+
+	ipts_control_restore_settings(ipts);
+	return ipts_control_start_io(ipts);
+}
+
+int ipts_control_reset(struct ipts_context *ipts, enum ipts_reset_type type)
+{
+	int ret = 0;
+	ktime_t start = ktime_get();
+
+	mutex_lock(&ipts->control_lock);
+
+	if (!ipts_control_active(ipts)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	dev_info(ipts->dev, "Resetting touch sensor (%s)\n",
+		 type == IPTS_RESET_TYPE_HARD ? "hard" : "soft");
+
+	ret = _ipts_control_reset(ipts, type);
+	if (!ret) {
+		dev_info(ipts->dev, "Touch sensor was reset in %lld us\n",
+			 ktime_us_delta(ktime_get(), start));
+		goto out;
+	}
+
+	/*
+	 * Some devices never come back from a reset. Starting over is the only way out then.
+	 */
+	dev_warn(ipts->dev, "Failed to reset in place, restarting: %d\n", ret);
+
+	ret = _ipts_control_restart(ipts);
+	if (ret)
+		dev_err(ipts->dev, "Failed to restart IPTS: %d\n", ret);
+
+out:
+	mutex_unlock(&ipts->control_lock);
+	return ret;
+}
+
+void ipts_control_reset_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct ipts_context *ipts = container_of(work, struct ipts_context, reset_work);
+
+	ret = ipts_control_reset(ipts, IPTS_RESET_TYPE_SOFT);
+	if (ret)
+		dev_err(ipts->dev, "Failed to reset touch sensor: %d\n", ret);
+}
+
+bool ipts_control_check_reset(struct ipts_context *ipts, int status, u8 reason)
+{
+	if (status != IPTS_STATUS_SENSOR_EXPECTED_RESET &&
+	    status != IPTS_STATUS_SENSOR_UNEXPECTED_RESET &&
+	    status != IPTS_STATUS_SENSOR_DISABLED)
+		return false;
+
+	ipts_control_schedule_recovery(ipts, status, reason);
+	return true;
+}
+
+/**
+ * ipts_control_recover() - Set up the ME again after the touch sensor was reset.
+ *
+ * If the ME expected the reset, it still knows about the sensor, and only the data flow has
+ * to be set up again. Otherwise, the sensor has to be reinitialized, but as long as it still
+ * is the same device, the buffers and the HID device can be kept.
+ *
+ * @ipts:
+ *     The IPTS driver context.
+ *
+ * Returns: 0 on success, <0 on error, >0 on ME error.
+ */
+static int ipts_control_recover(struct ipts_context *ipts)
+{
+	int ret = 0;
+	struct ipts_rsp_get_device_info info = ipts->info;
+
+	if (ipts->reset_status == IPTS_STATUS_SENSOR_EXPECTED_RESET) {
+		ipts_control_restore_settings(ipts);
+
+		ret = ipts_control_start_io(ipts);
+		if (!ret)
+			return 0;
+
+		ret = ipts_receiver_stop(ipts);
+		if (ret)
+			return ret;
+	}
+
+	ret = ipts_control_notify_dev_ready(ipts);
+	if (ret)
+		return ret;
+
+	ret = ipts_control_get_device_info(ipts);
+	if (ret)
+		return ret;
+
+	if (ipts->info.vendor != info.vendor || ipts->info.product != info.product ||
+	    ipts->info.data_size != info.data_size ||
+	    ipts->info.feedback_size != info.feedback_size)
+		return -ENODEV;
+
+	ipts_control_restore_settings(ipts);
+	return ipts_control_start_io(ipts);
+}
+
+void ipts_control_recovery_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct ipts_context *ipts = container_of(work, struct ipts_context, recovery_work);
+
+	ktime_t start = ktime_get();
+
+	mutex_lock(&ipts->control_lock);
+
+	/*
+	 * If the driver was stopped or suspended in the meantime, there is nothing to recover.
+	 */
+	if (!ipts_control_active(ipts))
+		goto out;
+
+	dev_warn(ipts->dev, "Recovering touch sensor (status: %d, reason: %u)\n",
+		 ipts->reset_status, ipts->reset_reason);
+
+	/*
+	 * If an earlier restart has failed, there is nothing to recover in place.
+	 */
+	if (!ipts_control_has_buffers(ipts)) {
+		ret = -ENODEV;
+		goto restart;
+	}
+
+	/*
+	 * The receiver knows that the ME has lost its state and exits without flushing.
+	 */
+	ret = ipts_receiver_stop(ipts);
+	if (ret)
+		goto restart;
+
+	ipts_control_flush_messages(ipts);
+
+	ret = ipts_control_recover(ipts);
+	if (!ret)
+		goto done;
+
+	/*
+	 * Resetting the sensor ourselves is still much faster than starting over.
+	 */
+	dev_warn(ipts->dev, "Failed to recover in place, resetting touch sensor: %d\n", ret);
+
+	ret = _ipts_control_reset(ipts, IPTS_RESET_TYPE_SOFT);
+	if (!ret)
+		goto done;
+
+restart:
+	dev_warn(ipts->dev, "Failed to recover in place, restarting: %d\n", ret);
+
+	ret = _ipts_control_restart(ipts);
+	if (ret) {
+		dev_err(ipts->dev, "Failed to restart IPTS: %d\n", ret);
+		goto out;
+	}
+
+done:
+	ipts->recovery_count++;
+	ipts->recovery_time = ktime_us_delta(ktime_get(), start);
+
+	dev_info(ipts->dev, "Recovered from sensor reset in %u us\n", ipts->recovery_time);
+
+out:
+	mutex_unlock(&ipts->control_lock);
+}
+
+int ipts_control_sleep(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	WRITE_ONCE(ipts->sensor_idle, true);
+
+	ret = ipts_control_set_sensor_state(ipts, IPTS_FEEDBACK_CMD_TYPE_GOTO_SLEEP);
+	if (ret == -EOPNOTSUPP)
+		return 0;
+
+	return ret;
+}
+
+int ipts_control_wake(struct ipts_context *ipts)
+{
+	int ret = 0;
+
+	WRITE_ONCE(ipts->sensor_idle, false);
+
+	ret = ipts_control_set_sensor_state(ipts, IPTS_FEEDBACK_CMD_TYPE_GOTO_SENSING);
+	if (ret == -EOPNOTSUPP)
+		return 0;
+
+	return ret;
+}
+
+void ipts_control_sleep_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct ipts_context *ipts = container_of(work, struct ipts_context, sleep_work.work);
+
+	/*
+	 * Errors are not fatal, a sensor that didn't go to sleep just keeps running.
+	 */
+	ret = ipts_control_sleep(ipts);
+	if (ret)
+		dev_warn(ipts->dev, "Failed to put touch sensor to sleep: %d\n", ret);
+}
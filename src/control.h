@@ -9,6 +9,7 @@
 #define IPTS_CONTROL_H
 
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "context.h"
 #include "spec-dma.h"
@@ -18,12 +19,32 @@ int ipts_control_request_flush(struct ipts_context *ipts);
 int ipts_control_wait_flush(struct ipts_context *ipts);
 int ipts_control_request_data(struct ipts_context *ipts);
 int ipts_control_wait_data(struct ipts_context *ipts, struct ipts_rsp_ready_for_data *response);
+int ipts_control_check_data(struct ipts_context *ipts, struct ipts_rsp_ready_for_data *response);
 int ipts_control_refill_buffer(struct ipts_context *ipts, struct ipts_data_buffer *buffer);
+int ipts_control_get_device_info(struct ipts_context *ipts);
+int ipts_control_get_policy(struct ipts_context *ipts, struct ipts_policy *policy);
+int ipts_control_set_policy(struct ipts_context *ipts);
+int ipts_control_reset_sensor(struct ipts_context *ipts, enum ipts_reset_type type);
 int ipts_control_hid2me_feedback(struct ipts_context *ipts, enum ipts_feedback_cmd_type cmd_type,
 				 enum ipts_feedback_data_type data_type, void *data, size_t size);
 
 int ipts_control_start(struct ipts_context *ipts);
 int ipts_control_stop(struct ipts_context *ipts);
 int ipts_control_restart(struct ipts_context *ipts);
+int ipts_control_switch_mode(struct ipts_context *ipts, enum ipts_mode mode);
+int ipts_control_reset(struct ipts_context *ipts, enum ipts_reset_type type);
+
+int ipts_control_suspend(struct ipts_context *ipts);
+int ipts_control_resume(struct ipts_context *ipts);
+
+void ipts_control_schedule_recovery(struct ipts_context *ipts, int status, u8 reason);
+bool ipts_control_check_reset(struct ipts_context *ipts, int status, u8 reason);
+void ipts_control_recovery_work(struct work_struct *work);
+void ipts_control_restart_work(struct work_struct *work);
+void ipts_control_reset_work(struct work_struct *work);
+
+int ipts_control_sleep(struct ipts_context *ipts);
+int ipts_control_wake(struct ipts_context *ipts);
+void ipts_control_sleep_work(struct work_struct *work);
 
 #endif /* IPTS_CONTROL_H */
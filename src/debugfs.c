@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#include <linux/bits.h>
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/types.h>
+
+#include "debugfs.h"
+#include "context.h"
+#include "stats.h"
+
+static struct dentry *ipts_debugfs_root;
+
+static const char *const ipts_stat_names[IPTS_STAT_COUNT] = {
+	[IPTS_STAT_FRAME_RECEIVED] = "frame_received",
+	[IPTS_STAT_FRAME_FORWARDED] = "frame_forwarded",
+	[IPTS_STAT_HID_RECEIVED] = "hid_received",
+	[IPTS_STAT_HID_FORWARDED] = "hid_forwarded",
+	[IPTS_STAT_FEATURES_RECEIVED] = "features_received",
+	[IPTS_STAT_UNKNOWN_RECEIVED] = "unknown_received",
+	[IPTS_STAT_BYTES_RECEIVED] = "bytes_received",
+	[IPTS_STAT_REFILL_ERRORS] = "refill_errors",
+	[IPTS_STAT_SEND_ERRORS] = "send_errors",
+	[IPTS_STAT_RECV_ERRORS] = "recv_errors",
+	[IPTS_STAT_EINTR_RETRIES] = "eintr_retries",
+	[IPTS_STAT_TIMEOUTS] = "timeouts",
+	[IPTS_STAT_POLL_DATA] = "poll_data",
+	[IPTS_STAT_POLL_EMPTY] = "poll_empty",
+	[IPTS_STAT_OVERRUNS] = "overruns",
+};
+
+static int ipts_debugfs_stats_show(struct seq_file *s, void *data)
+{
+	int i = 0;
+	struct ipts_context *ipts = s->private;
+
+	for (i = 0; i < IPTS_STAT_COUNT; i++)
+		seq_printf(s, "%s: %llu\n", ipts_stat_names[i], ipts_stats_read(ipts->stats, i));
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(ipts_debugfs_stats);
+
+static const char *const ipts_phase_names[IPTS_PHASE_COUNT] = {
+	[IPTS_PHASE_READY] = "ready",
+	[IPTS_PHASE_DEVICE_INFO] = "device_info",
+	[IPTS_PHASE_RESOURCES] = "resources",
+	[IPTS_PHASE_DESCRIPTOR] = "descriptor",
+	[IPTS_PHASE_IO] = "io",
+	[IPTS_PHASE_HID] = "hid",
+};
+
+/*
+ * How long each phase of the last start took, in microseconds.
+ */
+static int ipts_debugfs_start_show(struct seq_file *s, void *data)
+{
+	int i = 0;
+	struct ipts_context *ipts = s->private;
+
+	for (i = 0; i < IPTS_PHASE_COUNT; i++)
+		seq_printf(s, "%s: %u\n", ipts_phase_names[i], READ_ONCE(ipts->start_time[i]));
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(ipts_debugfs_start);
+
+static const char *const ipts_latency_names[IPTS_LATENCY_COUNT] = {
+	[IPTS_LATENCY_DOORBELL_DISPATCH] = "doorbell_dispatch",
+	[IPTS_LATENCY_DISPATCH_HID] = "dispatch_hid",
+	[IPTS_LATENCY_FEEDBACK] = "feedback",
+	[IPTS_LATENCY_READY_FOR_DATA] = "ready_for_data",
+	[IPTS_LATENCY_GET_FEATURE] = "get_feature",
+};
+
+/*
+ * Every line of a histogram is the upper bound of a bucket in nanoseconds, followed by how many
+ * samples fell into it. The last bucket has no upper bound, it is labelled with its lower bound
+ * instead. Empty buckets are skipped. Writing anything to the file resets all histograms.
+ */
+static int ipts_debugfs_latency_show(struct seq_file *s, void *data)
+{
+	int i = 0;
+	int bucket = 0;
+	struct ipts_context *ipts = s->private;
+
+	for (i = 0; i < IPTS_LATENCY_COUNT; i++) {
+		seq_printf(s, "%s:\n", ipts_latency_names[i]);
+
+		for (bucket = 0; bucket < IPTS_LATENCY_BUCKETS; bucket++) {
+			u64 count = ipts_stats_read_latency(ipts->stats, i, bucket);
+
+			if (!count)
+				continue;
+
+			if (bucket == IPTS_LATENCY_BUCKETS - 1)
+				seq_printf(s, "  >= %llu: %llu\n", BIT_ULL(bucket - 1), count);
+			else
+				seq_printf(s, "  < %llu: %llu\n", BIT_ULL(bucket), count);
+		}
+	}
+
+	return 0;
+}
+
+static int ipts_debugfs_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ipts_debugfs_latency_show, inode->i_private);
+}
+
+static ssize_t ipts_debugfs_latency_write(struct file *file, const char __user *buf,
+					  size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct ipts_context *ipts = s->private;
+
+	ipts_stats_reset_latency(ipts->stats);
+	return count;
+}
+
+static const struct file_operations ipts_debugfs_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = ipts_debugfs_latency_open,
+	.read = seq_read,
+	.write = ipts_debugfs_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void ipts_debugfs_register(void)
+{
+	ipts_debugfs_root = debugfs_create_dir("ipts", NULL);
+}
+
+void ipts_debugfs_unregister(void)
+{
+	debugfs_remove_recursive(ipts_debugfs_root);
+	ipts_debugfs_root = NULL;
+}
+
+void ipts_debugfs_init(struct ipts_context *ipts)
+{
+	ipts->debugfs = debugfs_create_dir(dev_name(ipts->dev), ipts_debugfs_root);
+
+	debugfs_create_file("stats", 0444, ipts->debugfs, ipts, &ipts_debugfs_stats_fops);
+	debugfs_create_file("start", 0444, ipts->debugfs, ipts, &ipts_debugfs_start_fops);
+	debugfs_create_file("latency", 0644, ipts->debugfs, ipts, &ipts_debugfs_latency_fops);
+}
+
+void ipts_debugfs_free(struct ipts_context *ipts)
+{
+	debugfs_remove_recursive(ipts->debugfs);
+	ipts->debugfs = NULL;
+}
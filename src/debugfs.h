@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#ifndef IPTS_DEBUGFS_H
+#define IPTS_DEBUGFS_H
+
+#include "context.h"
+
+void ipts_debugfs_register(void);
+void ipts_debugfs_unregister(void);
+
+void ipts_debugfs_init(struct ipts_context *ipts);
+void ipts_debugfs_free(struct ipts_context *ipts);
+
+#endif /* IPTS_DEBUGFS_H */
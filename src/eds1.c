@@ -43,6 +43,15 @@ static int ipts_eds1_switch_mode(struct ipts_context *ipts, enum ipts_mode mode)
 	if (ipts->mode == mode)
 		return 0;
 
+	ret = ipts_control_switch_mode(ipts, mode);
+	if (!ret)
+		return 0;
+
+	/*
+	 * If the ME did not accept the new mode in place, fall back to a full restart.
+	 */
+	dev_warn(ipts->dev, "Failed to switch modes in place, restarting: %d\n", ret);
+
 	ipts->mode = mode;
 
 	ret = ipts_control_restart(ipts);
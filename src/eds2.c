@@ -8,9 +8,16 @@
 #include <linux/completion.h>
 #include <linux/err.h>
 #include <linux/gfp.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/overflow.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "eds2.h"
 #include "context.h"
@@ -18,6 +25,7 @@
 #include "resources.h"
 #include "spec-dma.h"
 #include "spec-hid.h"
+#include "stats.h"
 
 /**
  * GET_FEATURES_TIMEOUT - How long to wait for the reply to a GET_FEATURES request.
@@ -27,6 +35,53 @@
  */
 #define GET_FEATURES_TIMEOUT 30 * MSEC_PER_SEC
 
+/**
+ * OUTPUT_QUEUE_SIZE - How many writes can be waiting to be sent to the ME.
+ */
+#define OUTPUT_QUEUE_SIZE 16
+
+/**
+ * FEATURE_CACHE_IDS - How many report IDs can be marked as cacheable.
+ */
+#define FEATURE_CACHE_IDS 16
+
+static unsigned int feature_cache_ms;
+module_param(feature_cache_ms, uint, 0644);
+MODULE_PARM_DESC(feature_cache_ms,
+		 "How long the answer to a GET_FEATURE request can be reused in ms (default: 0)");
+
+/*
+ * Most feature reports change on their own, so reusing an old answer would hide the change.
+ * Only reports that userspace knows to be read-only can be cached.
+ */
+static u8 feature_cache_ids[FEATURE_CACHE_IDS];
+static unsigned int feature_cache_count;
+module_param_array(feature_cache_ids, byte, &feature_cache_count, 0444);
+MODULE_PARM_DESC(feature_cache_ids,
+		 "The read-only feature reports to which feature_cache_ms applies (default: none)");
+
+/**
+ * struct ipts_eds2_output - A SET_FEATURE request or output report waiting in the output queue.
+ *
+ * @list:
+ *     The entry in &ipts_context->output_queue.
+ *
+ * @type:
+ *     The kind of report. See &enum ipts_feedback_data_type.
+ *
+ * @size:
+ *     The size of the report, including the report ID.
+ *
+ * @data:
+ *     The report, starting with the report ID.
+ */
+struct ipts_eds2_output {
+	struct list_head list;
+	enum ipts_feedback_data_type type;
+	size_t size;
+	u8 data[];
+};
+
 int ipts_eds2_get_descriptor(struct ipts_context *ipts, u8 **desc_buffer, size_t *desc_size)
 {
 	u8 *buffer = NULL;
@@ -54,61 +109,244 @@ int ipts_eds2_get_descriptor(struct ipts_context *ipts, u8 **desc_buffer, size_t
 	return 0;
 }
 
+static bool ipts_eds2_feature_cacheable(u8 report_id)
+{
+	unsigned int i = 0;
+
+	for (i = 0; i < feature_cache_count; i++) {
+		if (feature_cache_ids[i] == report_id)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * ipts_eds2_reuse_feature() - Try to answer a GET_FEATURE request from the feature buffer.
+ *
+ * The feature buffer keeps the answer to the last GET_FEATURE request until the next one
+ * arrives. If that answer is for the same report, and no write has happened since it was
+ * requested, it can be handed out again instead of asking the ME.
+ *
+ * Must be called with &ipts_context->feature_lock held.
+ *
+ * Returns: The size of the report on success, -ENODATA if the answer can't be reused,
+ *          negative errno code on error.
+ */
+static int ipts_eds2_reuse_feature(struct ipts_context *ipts, u8 *buffer, size_t size,
+				   u8 report_id)
+{
+	struct ipts_buffer feature = ipts->resources.feature;
+	struct ipts_data_buffer *response = (struct ipts_data_buffer *)feature.address;
+
+	if (!ipts->feature_valid || ipts->feature_report != report_id)
+		return -ENODATA;
+
+	if (ipts->feature_cache_writes != atomic_read(&ipts->feature_writes))
+		return -ENODATA;
+
+	if (!response || response->size == 0 || response->data[0] != report_id)
+		return -ENODATA;
+
+	if (response->size > size)
+		return -ETOOSMALL;
+
+	memcpy(buffer, response->data, response->size);
+	return response->size;
+}
+
 static int ipts_eds2_get_feature(struct ipts_context *ipts, u8 *buffer, size_t size, u8 report_id,
 				 enum ipts_feedback_data_type type)
 {
 	int ret = 0;
+	int writes = 0;
+	u32 seq = READ_ONCE(ipts->feature_seq);
+	ktime_t start = 0;
 
 	struct ipts_buffer feature = ipts->resources.feature;
 	struct ipts_data_buffer *response = (struct ipts_data_buffer *)feature.address;
 
 	mutex_lock(&ipts->feature_lock);
 
+	/*
+	 * If a request for the same report was answered while we were waiting for the lock,
+	 * share its answer instead of sending the same slow request again.
+	 *
+	 * Optionally, answers to read-only reports can also be reused for a short time after they
+	 * have arrived.
+	 */
+	if (ipts->feature_seq != seq || (ipts_eds2_feature_cacheable(report_id) &&
+					 time_before(jiffies, ipts->feature_expires))) {
+		ret = ipts_eds2_reuse_feature(ipts, buffer, size, report_id);
+		if (ret != -ENODATA)
+			goto out;
+	}
+
+	/*
+	 * Writes are sent from a work item. The answer must reflect all of them, so they have to
+	 * reach the ME before the request does.
+	 */
+	ipts_eds2_flush_output(ipts);
+
+	ipts->feature_valid = false;
+	writes = atomic_read(&ipts->feature_writes);
+
 	memset(buffer, 0, size);
 	buffer[0] = report_id;
 
 	reinit_completion(&ipts->feature_event);
 
+	start = ktime_get();
+
 	ret = ipts_control_hid2me_feedback(ipts, IPTS_FEEDBACK_CMD_TYPE_NONE, type, buffer, size);
 	if (ret) {
 		dev_err(ipts->dev, "Failed to send hid2me feedback: %d\n", ret);
-		goto out;
+		goto done;
 	}
 
 	ret = wait_for_completion_timeout(&ipts->feature_event,
 					  msecs_to_jiffies(GET_FEATURES_TIMEOUT));
 
 	if (ret == 0) {
+		ipts_stats_inc(ipts->stats, IPTS_STAT_TIMEOUTS);
 		dev_warn(ipts->dev, "GET_FEATURES timed out!\n");
 		ret = -ETIMEDOUT;
-		goto out;
+		goto done;
 	}
 
+	ipts_stats_latency(ipts->stats, IPTS_LATENCY_GET_FEATURE, start);
+
 	if (response->size > size) {
 		ret = -ETOOSMALL;
-		goto out;
+		goto done;
 	}
 
 	ret = response->size;
 	memcpy(buffer, response->data, response->size);
 
+	ipts->feature_valid = true;
+	ipts->feature_report = report_id;
+	ipts->feature_cache_writes = writes;
+	ipts->feature_expires = jiffies + msecs_to_jiffies(READ_ONCE(feature_cache_ms));
+
+done:
+	WRITE_ONCE(ipts->feature_seq, ipts->feature_seq + 1);
+
 out:
 	mutex_unlock(&ipts->feature_lock);
 	return ret;
 }
 
+/**
+ * ipts_eds2_set_feature() - Queue a SET_FEATURE request or an output report.
+ *
+ * Sending HID2ME feedback requires a round trip to the ME. To not block the writer, the report
+ * is put into a queue that is sent to the ME from a work item. If the last report in the queue
+ * is of the same kind and has the same ID, it has not been sent yet and can be overwritten,
+ * because the device would only see the newer data in the end anyway.
+ *
+ * Returns: 0 on success, negative errno code on error.
+ */
 static int ipts_eds2_set_feature(struct ipts_context *ipts, u8 *buffer, size_t size, u8 report_id,
 				 enum ipts_feedback_data_type type)
 {
-	int ret = 0;
+	struct ipts_eds2_output *entry = NULL;
+	struct ipts_eds2_output *last = NULL;
+
+	if (size == 0)
+		return -EINVAL;
+
+	if (size + sizeof(struct ipts_feedback_buffer) > ipts->resources.hid2me.size)
+		return -EINVAL;
+
+	entry = kmalloc(struct_size(entry, data, size), GFP_KERNEL);
+	if (!entry)
+		return -ENOMEM;
 
 	buffer[0] = report_id;
 
-	ret = ipts_control_hid2me_feedback(ipts, IPTS_FEEDBACK_CMD_TYPE_NONE, type, buffer, size);
-	if (ret)
-		dev_err(ipts->dev, "Failed to send hid2me feedback: %d\n", ret);
+	entry->type = type;
+	entry->size = size;
+	memcpy(entry->data, buffer, size);
 
-	return ret;
+	/*
+	 * Writing to the device can change the answer to GET_FEATURE requests.
+	 */
+	atomic_inc(&ipts->feature_writes);
+
+	spin_lock(&ipts->output_lock);
+
+	if (!list_empty(&ipts->output_queue))
+		last = list_last_entry(&ipts->output_queue, struct ipts_eds2_output, list);
+
+	if (last && last->type == type && last->size == size && last->data[0] == report_id) {
+		memcpy(last->data, entry->data, size);
+		spin_unlock(&ipts->output_lock);
+
+		kfree(entry);
+		return 0;
+	}
+
+	if (ipts->output_pending >= OUTPUT_QUEUE_SIZE) {
+		spin_unlock(&ipts->output_lock);
+
+		kfree(entry);
+		return -EAGAIN;
+	}
+
+	list_add_tail(&entry->list, &ipts->output_queue);
+	ipts->output_pending++;
+
+	spin_unlock(&ipts->output_lock);
+
+	schedule_work(&ipts->output_work);
+	return 0;
+}
+
+void ipts_eds2_output_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct ipts_context *ipts = container_of(work, struct ipts_context, output_work);
+
+	while (true) {
+		struct ipts_eds2_output *entry = NULL;
+
+		spin_lock(&ipts->output_lock);
+
+		entry = list_first_entry_or_null(&ipts->output_queue, struct ipts_eds2_output, list);
+		if (entry) {
+			list_del(&entry->list);
+			ipts->output_pending--;
+		}
+
+		spin_unlock(&ipts->output_lock);
+
+		if (!entry)
+			break;
+
+		/*
+		 * If the HID interface has been shut down, the queue is only drained.
+		 */
+		if (READ_ONCE(ipts->hid_active)) {
+			ret = ipts_control_hid2me_feedback(ipts, IPTS_FEEDBACK_CMD_TYPE_NONE,
+							   entry->type, entry->data, entry->size);
+			if (ret)
+				dev_err(ipts->dev, "Failed to send hid2me feedback: %d\n", ret);
+		}
+
+		kfree(entry);
+	}
+}
+
+/**
+ * ipts_eds2_flush_output() - Wait until the output queue has been processed.
+ *
+ * While the HID interface is active, all queued reports are sent to the ME. Otherwise they
+ * are dropped.
+ */
+void ipts_eds2_flush_output(struct ipts_context *ipts)
+{
+	flush_work(&ipts->output_work);
 }
 
 int ipts_eds2_raw_request(struct ipts_context *ipts, u8 *buffer, size_t size, u8 report_id,
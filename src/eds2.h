@@ -10,10 +10,14 @@
 
 #include <linux/hid.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "context.h"
 
 int ipts_eds2_get_descriptor(struct ipts_context *ipts, u8 **desc_buffer, size_t *desc_size);
+void ipts_eds2_output_work(struct work_struct *work);
+void ipts_eds2_flush_output(struct ipts_context *ipts);
+
 int ipts_eds2_raw_request(struct ipts_context *ipts, u8 *buffer, size_t size, u8 report_id,
 			  enum hid_report_type report_type, enum hid_class_request request_type);
 
@@ -12,14 +12,18 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "context.h"
+#include "control.h"
 #include "eds1.h"
 #include "eds2.h"
 #include "hid.h"
 #include "resources.h"
 #include "spec-dma.h"
 #include "spec-hid.h"
+#include "stats.h"
+#include "trace.h"
 
 static int ipts_hid_start(struct hid_device *hid)
 {
@@ -30,31 +34,62 @@ static void ipts_hid_stop(struct hid_device *hid)
 {
 }
 
-static int ipts_hid_parse(struct hid_device *hid)
+/*
+ * The HID core counts the users of the device itself, and only calls these functions when the
+ * first user opens the device and when the last user closes it.
+ *
+ * Once the last user is gone, the touch sensor can be put to sleep after the delay that was
+ * configured through the sleep_delay attribute. The next user wakes it up again.
+ */
+
+static int ipts_hid_open(struct hid_device *hid)
 {
 	int ret = 0;
+	struct ipts_context *ipts = hid->driver_data;
 
-	u8 *buffer = NULL;
-	size_t size = 0;
+	cancel_delayed_work_sync(&ipts->sleep_work);
+	WRITE_ONCE(ipts->hid_opened, true);
 
+	if (!READ_ONCE(ipts->sensor_idle))
+		return 0;
+
+	/*
+	 * A sensor that didn't wake up is not fatal, it can still be reset.
+	 */
+	ret = ipts_control_wake(ipts);
+	if (ret)
+		dev_warn(ipts->dev, "Failed to wake up touch sensor: %d\n", ret);
+
+	return 0;
+}
+
+static void ipts_hid_close(struct hid_device *hid)
+{
+	unsigned int delay = 0;
 	struct ipts_context *ipts = hid->driver_data;
 
-	if (!READ_ONCE(ipts->hid_active))
-		return -ENODEV;
+	WRITE_ONCE(ipts->hid_opened, false);
 
-	if (ipts->eds_intf_rev == 1)
-		ret = ipts_eds1_get_descriptor(ipts, &buffer, &size);
-	else
-		ret = ipts_eds2_get_descriptor(ipts, &buffer, &size);
+	delay = READ_ONCE(ipts->sleep_delay);
+	if (delay)
+		schedule_delayed_work(&ipts->sleep_work, msecs_to_jiffies(delay));
+}
 
-	if (ret) {
-		dev_err(ipts->dev, "Failed to allocate HID descriptor: %d\n", ret);
-		return ret;
-	}
+static int ipts_hid_parse(struct hid_device *hid)
+{
+	int ret = 0;
+	struct ipts_context *ipts = hid->driver_data;
 
-	ret = hid_parse_report(hid, buffer, size);
-	kfree(buffer);
+	if (!READ_ONCE(ipts->hid_active))
+		return -ENODEV;
 
+	if (!ipts->descriptor)
+		return -ENODATA;
+
+	/*
+	 * The HID core makes its own copy of the descriptor, so the cached one can be passed as is.
+	 */
+	ret = hid_parse_report(hid, ipts->descriptor, ipts->descriptor_size);
 	if (ret) {
 		dev_err(ipts->dev, "Failed to parse HID descriptor: %d\n", ret);
 		return ret;
@@ -83,8 +118,8 @@ static int ipts_hid_raw_request(struct hid_device *hid, unsigned char report_id,
 static struct hid_ll_driver ipts_hid_driver = {
 	.start = ipts_hid_start,
 	.stop = ipts_hid_stop,
-	.open = ipts_hid_start,
-	.close = ipts_hid_stop,
+	.open = ipts_hid_open,
+	.close = ipts_hid_close,
 	.parse = ipts_hid_parse,
 	.raw_request = ipts_hid_raw_request,
 };
@@ -106,13 +141,14 @@ static struct hid_ll_driver ipts_hid_driver = {
  */
 static int ipts_hid_handle_frame(struct ipts_context *ipts, struct ipts_data_buffer *buffer)
 {
+	int ret = 0;
 	struct ipts_hid_report_data *report = NULL;
 
 	if (buffer->size + sizeof(*report) > IPTS_HID_REPORT_DATA_SIZE)
 		return -ERANGE;
 
 	report = (struct ipts_hid_report_data *)ipts->resources.report.address;
-	memset(report, 0, ipts->resources.report.size);
+	memset(report, 0, sizeof(*report));
 
 	/*
 	 * Synthesize a HID report that matches how the Surface Pro 7 transmits multitouch data.
@@ -124,13 +160,32 @@ static int ipts_hid_handle_frame(struct ipts_context *ipts, struct ipts_data_buf
 
 	memcpy(report->gesture_char_quality.data, buffer->data, buffer->size);
 
-	return hid_input_report(ipts->hid, HID_INPUT_REPORT, (u8 *)report,
-				IPTS_HID_REPORT_DATA_SIZE, 1);
+	/*
+	 * The frame is copied straight into the report, so only the space behind it has to be
+	 * cleared. Zeroing the whole report first would touch every byte of it twice.
+	 */
+	memset(&report->gesture_char_quality.data[buffer->size], 0,
+	       ipts->resources.report.size - sizeof(*report) - buffer->size);
+
+	ret = hid_input_report(ipts->hid, HID_INPUT_REPORT, (u8 *)report,
+			       IPTS_HID_REPORT_DATA_SIZE, 1);
+	if (ret)
+		return ret;
+
+	ipts_stats_inc(ipts->stats, IPTS_STAT_FRAME_FORWARDED);
+	return 0;
 }
 
 static int ipts_hid_handle_hid(struct ipts_context *ipts, struct ipts_data_buffer *buffer)
 {
-	return hid_input_report(ipts->hid, HID_INPUT_REPORT, buffer->data, buffer->size, 1);
+	int ret = 0;
+
+	ret = hid_input_report(ipts->hid, HID_INPUT_REPORT, buffer->data, buffer->size, 1);
+	if (ret)
+		return ret;
+
+	ipts_stats_inc(ipts->stats, IPTS_STAT_HID_FORWARDED);
+	return 0;
 }
 
 /**
@@ -163,18 +218,39 @@ int ipts_hid_input_data(struct ipts_context *ipts, struct ipts_data_buffer *buff
 	if (!READ_ONCE(ipts->hid_active))
 		return -ENODEV;
 
+	trace_ipts_input_data(buffer->total_index % ipts->buffers, buffer->type, buffer->size,
+			      buffer->total_index, buffer->transaction);
+
 	if (buffer->size == 0)
 		return 0;
 
+	ipts_stats_add(ipts->stats, IPTS_STAT_BYTES_RECEIVED, buffer->size);
+
+	/*
+	 * Touch data is only useful if someone is listening. The answers to GET_FEATURES requests
+	 * must always be processed, because a thread is waiting for them.
+	 */
 	switch (buffer->type) {
 	case IPTS_DATA_TYPE_FRAME:
+		ipts_stats_inc(ipts->stats, IPTS_STAT_FRAME_RECEIVED);
+
+		if (!READ_ONCE(ipts->hid_opened))
+			return 0;
+
 		return ipts_hid_handle_frame(ipts, buffer);
 	case IPTS_DATA_TYPE_HID:
+		ipts_stats_inc(ipts->stats, IPTS_STAT_HID_RECEIVED);
+
+		if (!READ_ONCE(ipts->hid_opened))
+			return 0;
+
 		return ipts_hid_handle_hid(ipts, buffer);
 	case IPTS_DATA_TYPE_GET_FEATURES:
+		ipts_stats_inc(ipts->stats, IPTS_STAT_FEATURES_RECEIVED);
 		return ipts_hid_handle_get_features(ipts, buffer);
 	default:
-		dev_info(ipts->dev, "Unhandled data type: %d\n", buffer->type);
+		ipts_stats_inc(ipts->stats, IPTS_STAT_UNKNOWN_RECEIVED);
+		dev_info_ratelimited(ipts->dev, "Unhandled data type: %d\n", buffer->type);
 	}
 
 	return 0;
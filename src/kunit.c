@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#include <kunit/test.h>
+#include <linux/limits.h>
+#include <linux/types.h>
+
+#include "mei.h"
+#include "receiver.h"
+#include "spec-mei.h"
+#include "spi.h"
+#include "stats.h"
+
+/*
+ * These tests only cover logic that doesn't need to talk to the ME.
+ */
+
+static void ipts_test_mei_match_code(struct kunit *test)
+{
+	struct ipts_response rsp = { 0 };
+
+	rsp.cmd = IPTS_ME_2_HOST_MSG(IPTS_CMD_GET_DEVICE_INFO);
+
+	KUNIT_EXPECT_TRUE(test, ipts_mei_match(&rsp, IPTS_CMD_GET_DEVICE_INFO, -1));
+	KUNIT_EXPECT_FALSE(test, ipts_mei_match(&rsp, IPTS_CMD_SET_MODE, -1));
+
+	/*
+	 * Commands that the host sent must never be taken for an answer.
+	 */
+	rsp.cmd = IPTS_CMD_GET_DEVICE_INFO;
+	KUNIT_EXPECT_FALSE(test, ipts_mei_match(&rsp, IPTS_CMD_GET_DEVICE_INFO, -1));
+}
+
+static void ipts_test_mei_match_feedback(struct kunit *test)
+{
+	struct ipts_response rsp = { 0 };
+
+	rsp.cmd = IPTS_ME_2_HOST_MSG(IPTS_CMD_FEEDBACK);
+	rsp.payload.feedback.feedback_index = 3;
+
+	KUNIT_EXPECT_TRUE(test, ipts_mei_match(&rsp, IPTS_CMD_FEEDBACK, -1));
+	KUNIT_EXPECT_TRUE(test, ipts_mei_match(&rsp, IPTS_CMD_FEEDBACK, 3));
+	KUNIT_EXPECT_FALSE(test, ipts_mei_match(&rsp, IPTS_CMD_FEEDBACK, 4));
+
+	rsp.payload.feedback.feedback_index = IPTS_HID_2_ME_BUFFER_INDEX;
+	KUNIT_EXPECT_TRUE(test, ipts_mei_match(&rsp, IPTS_CMD_FEEDBACK,
+					       IPTS_HID_2_ME_BUFFER_INDEX));
+	KUNIT_EXPECT_FALSE(test, ipts_mei_match(&rsp, IPTS_CMD_FEEDBACK, 0));
+}
+
+static struct kunit_case ipts_test_mei_cases[] = {
+	KUNIT_CASE(ipts_test_mei_match_code),
+	KUNIT_CASE(ipts_test_mei_match_feedback),
+	{},
+};
+
+static struct kunit_suite ipts_test_mei_suite = {
+	.name = "ipts_mei",
+	.test_cases = ipts_test_mei_cases,
+};
+
+static void ipts_test_stats_bucket(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(-1), 0);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(0), 0);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(1), 1);
+
+	/*
+	 * Bucket n takes everything from 2^(n - 1) up to 2^n - 1.
+	 */
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(2), 2);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(3), 2);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(4), 3);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(1023), 10);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(1024), 11);
+}
+
+static void ipts_test_stats_bucket_max(struct kunit *test)
+{
+	s64 last = 1LL << (IPTS_LATENCY_BUCKETS - 2);
+
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(last - 1), IPTS_LATENCY_BUCKETS - 2);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(last), IPTS_LATENCY_BUCKETS - 1);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(last * 2), IPTS_LATENCY_BUCKETS - 1);
+	KUNIT_EXPECT_EQ(test, ipts_stats_bucket(S64_MAX), IPTS_LATENCY_BUCKETS - 1);
+}
+
+static struct kunit_case ipts_test_stats_cases[] = {
+	KUNIT_CASE(ipts_test_stats_bucket),
+	KUNIT_CASE(ipts_test_stats_bucket_max),
+	{},
+};
+
+static struct kunit_suite ipts_test_stats_suite = {
+	.name = "ipts_stats",
+	.test_cases = ipts_test_stats_cases,
+};
+
+static void ipts_test_receiver_overruns(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(0, 0, 16), 0);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(0, 1, 16), 0);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(0, 16, 16), 0);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(0, 17, 16), 1);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(100, 140, 16), 24);
+
+	/*
+	 * In single buffer mode, every buffer that was not picked up is lost.
+	 */
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(5, 6, 1), 0);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(5, 8, 1), 2);
+}
+
+static void ipts_test_receiver_overruns_wrap(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(U32_MAX, 0, 16), 0);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(U32_MAX - 3, 12, 16), 0);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(U32_MAX - 3, 13, 16), 1);
+	KUNIT_EXPECT_EQ(test, ipts_receiver_overruns(U32_MAX - 9, 20, 16), 14);
+}
+
+static struct kunit_case ipts_test_receiver_cases[] = {
+	KUNIT_CASE(ipts_test_receiver_overruns),
+	KUNIT_CASE(ipts_test_receiver_overruns_wrap),
+	{},
+};
+
+static struct kunit_suite ipts_test_receiver_suite = {
+	.name = "ipts_receiver",
+	.test_cases = ipts_test_receiver_cases,
+};
+
+static void ipts_test_spi_order(struct kunit *test)
+{
+	u8 i = 0;
+	const struct ipts_spi_setting *prev = ipts_spi_get_setting(0);
+	const struct ipts_spi_setting *setting = NULL;
+
+	KUNIT_ASSERT_NOT_NULL(test, prev);
+
+	/*
+	 * Falling back must never make the bus faster. At the same frequency, quad IO is
+	 * tried before dual IO.
+	 */
+	for (i = 1; (setting = ipts_spi_get_setting(i)); i++) {
+		KUNIT_EXPECT_LE(test, setting->freq, prev->freq);
+
+		if (setting->freq == prev->freq)
+			KUNIT_EXPECT_LT(test, setting->io_mode, prev->io_mode);
+
+		prev = setting;
+	}
+
+	KUNIT_EXPECT_EQ(test, i, 4);
+	KUNIT_EXPECT_NULL(test, ipts_spi_get_setting(U8_MAX));
+}
+
+static void ipts_test_spi_overrides(struct kunit *test)
+{
+	u8 i = 0;
+	const struct ipts_spi_setting *setting = NULL;
+
+	for (i = 0; (setting = ipts_spi_get_setting(i)); i++) {
+		/*
+		 * The ME does not support 10MHz and 50MHz.
+		 */
+		KUNIT_EXPECT_NE(test, setting->freq_override, IPTS_SPI_FREQ_OVERRIDE_10MHZ);
+		KUNIT_EXPECT_NE(test, setting->freq_override, IPTS_SPI_FREQ_OVERRIDE_50MHZ);
+
+		if (setting->freq_override == IPTS_SPI_FREQ_OVERRIDE_30MHZ)
+			KUNIT_EXPECT_EQ(test, setting->freq, IPTS_SPI_FREQ_30MHZ);
+		else
+			KUNIT_EXPECT_EQ(test, setting->freq, IPTS_SPI_FREQ_17MHZ);
+
+		if (setting->io_mode_override == IPTS_SPI_IO_MODE_OVERRIDE_QUAD)
+			KUNIT_EXPECT_EQ(test, setting->io_mode, IPTS_SPI_IO_QUAD);
+		else
+			KUNIT_EXPECT_EQ(test, setting->io_mode, IPTS_SPI_IO_DUAL);
+	}
+}
+
+static struct kunit_case ipts_test_spi_cases[] = {
+	KUNIT_CASE(ipts_test_spi_order),
+	KUNIT_CASE(ipts_test_spi_overrides),
+	{},
+};
+
+static struct kunit_suite ipts_test_spi_suite = {
+	.name = "ipts_spi",
+	.test_cases = ipts_test_spi_cases,
+};
+
+kunit_test_suites(&ipts_test_mei_suite, &ipts_test_stats_suite, &ipts_test_receiver_suite,
+		  &ipts_test_spi_suite);
@@ -13,14 +13,24 @@
 #include <linux/mod_devicetable.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/pm.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/stddef.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "context.h"
 #include "control.h"
+#include "debugfs.h"
+#include "eds2.h"
 #include "mei.h"
 #include "spec-mei.h"
+#include "spi.h"
+#include "sysfs.h"
+
+#define CREATE_TRACE_POINTS
+#include "trace.h"
 
 static int ipts_set_dma_mask(struct mei_cl_device *cldev)
 {
@@ -53,6 +63,12 @@ static int ipts_probe(struct mei_cl_device *cldev, const struct mei_cl_device_id
 		return -ENOMEM;
 	}
 
+	ipts->stats = devm_alloc_percpu(&cldev->dev, struct ipts_stats);
+	if (!ipts->stats) {
+		mei_cldev_disable(cldev);
+		return -ENOMEM;
+	}
+
 	ipts_mei_init(&ipts->mei, cldev);
 
 	ipts->dev = &cldev->dev;
@@ -61,11 +77,31 @@ static int ipts_probe(struct mei_cl_device *cldev, const struct mei_cl_device_id
 	mutex_init(&ipts->feature_lock);
 	init_completion(&ipts->feature_event);
 
+	mutex_init(&ipts->control_lock);
+	INIT_WORK(&ipts->recovery_work, ipts_control_recovery_work);
+	INIT_DELAYED_WORK(&ipts->restart_work, ipts_control_restart_work);
+	INIT_WORK(&ipts->reset_work, ipts_control_reset_work);
+
+	mutex_init(&ipts->policy_lock);
+	ipts->policy.doze_timer = IPTS_DEFAULT_DOZE_TIMER_SECONDS;
+
+	INIT_WORK(&ipts->spi_work, ipts_spi_fallback_work);
+
+	mutex_init(&ipts->hid2me_lock);
+	spin_lock_init(&ipts->output_lock);
+	INIT_LIST_HEAD(&ipts->output_queue);
+	INIT_WORK(&ipts->output_work, ipts_eds2_output_work);
+
+	INIT_DELAYED_WORK(&ipts->sleep_work, ipts_control_sleep_work);
+
 	mei_cldev_set_drvdata(cldev, ipts);
 
+	ipts_debugfs_init(ipts);
+
 	ret = ipts_control_start(ipts);
 	if (ret) {
 		dev_err(&cldev->dev, "Failed to start IPTS: %d\n", ret);
+		ipts_debugfs_free(ipts);
 		return ret;
 	}
 
@@ -77,6 +113,8 @@ static void ipts_remove(struct mei_cl_device *cldev)
 	int ret = 0;
 	struct ipts_context *ipts = mei_cldev_get_drvdata(cldev);
 
+	ipts_debugfs_free(ipts);
+
 	ret = ipts_control_stop(ipts);
 	if (ret)
 		dev_err(&cldev->dev, "Failed to stop IPTS: %d\n", ret);
@@ -84,6 +122,43 @@ static void ipts_remove(struct mei_cl_device *cldev)
 	mei_cldev_disable(cldev);
 }
 
+static int ipts_suspend(struct device *dev)
+{
+	int ret = 0;
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	ret = ipts_control_suspend(ipts);
+	if (ret)
+		dev_err(dev, "Failed to suspend IPTS: %d\n", ret);
+
+	return ret;
+}
+
+static int ipts_resume(struct device *dev)
+{
+	int ret = 0;
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	/*
+	 * If the MEI client got disconnected while the system was asleep, reconnect it.
+	 */
+	if (!mei_cldev_enabled(ipts->mei.cldev)) {
+		ret = mei_cldev_enable(ipts->mei.cldev);
+		if (ret) {
+			dev_err(dev, "Failed to enable MEI device: %d\n", ret);
+			return ret;
+		}
+	}
+
+	ret = ipts_control_resume(ipts);
+	if (ret)
+		dev_err(dev, "Failed to resume IPTS: %d\n", ret);
+
+	return ret;
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(ipts_pm_ops, ipts_suspend, ipts_resume);
+
 static struct mei_cl_device_id ipts_device_id_table[] = {
 	{ .uuid = MEI_UUID_IPTS, .version = MEI_CL_VERSION_ANY },
 	{},
@@ -95,8 +170,37 @@ static struct mei_cl_driver ipts_driver = {
 	.name = "ipts",
 	.probe = ipts_probe,
 	.remove = ipts_remove,
+	.driver = {
+		/*
+		 * Starting IPTS requires multiple round trips to the ME, and waiting for the
+		 * touch sensor. There is no reason to hold up the boot process for that.
+		 */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+		.pm = pm_sleep_ptr(&ipts_pm_ops),
+		.dev_groups = ipts_sysfs_groups,
+	},
 };
-module_mei_cl_driver(ipts_driver);
+
+static int __init ipts_init(void)
+{
+	int ret = 0;
+
+	ipts_debugfs_register();
+
+	ret = mei_cldev_driver_register(&ipts_driver);
+	if (ret)
+		ipts_debugfs_unregister();
+
+	return ret;
+}
+module_init(ipts_init);
+
+static void __exit ipts_exit(void)
+{
+	mei_cldev_driver_unregister(&ipts_driver);
+	ipts_debugfs_unregister();
+}
+module_exit(ipts_exit);
 
 MODULE_DESCRIPTION("IPTS touchscreen driver");
 MODULE_AUTHOR("Dorian Stoll <dorian.stoll@tmsp.io>");
@@ -9,16 +9,65 @@
 #include <linux/device.h>
 #include <linux/errno.h>
 #include <linux/jiffies.h>
+#include <linux/jump_label.h>
+#include <linux/kernel.h>
 #include <linux/list.h>
 #include <linux/mei_cl_bus.h>
+#include <linux/moduleparam.h>
 #include <linux/printk.h>
 #include <linux/rwsem.h>
+#include <linux/sysfs.h>
 #include <linux/types.h>
 #include <linux/wait.h>
 
 #include "context.h"
 #include "mei.h"
 #include "spec-mei.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * Logging every message that is exchanged with the ME is expensive, because there are hundreds
+ * of them per second. It is disabled by default, and switched on and off with the mei_debug
+ * module parameter. While it is off, the check costs nothing but a patched out jump.
+ */
+static DEFINE_STATIC_KEY_FALSE(ipts_mei_debug);
+
+static int ipts_mei_debug_set(const char *val, const struct kernel_param *kp)
+{
+	int ret = 0;
+	bool enable = false;
+
+	ret = kstrtobool(val, &enable);
+	if (ret)
+		return ret;
+
+	if (enable)
+		static_branch_enable(&ipts_mei_debug);
+	else
+		static_branch_disable(&ipts_mei_debug);
+
+	return 0;
+}
+
+static int ipts_mei_debug_get(char *buffer, const struct kernel_param *kp)
+{
+	return sysfs_emit(buffer, "%c\n", static_key_enabled(&ipts_mei_debug) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops ipts_mei_debug_ops = {
+	.set = ipts_mei_debug_set,
+	.get = ipts_mei_debug_get,
+};
+
+module_param_cb(mei_debug, &ipts_mei_debug_ops, NULL, 0644);
+MODULE_PARM_DESC(mei_debug, "Log every message that is exchanged with the ME. (default: false)");
+
+#define ipts_mei_dbg(dev, fmt, ...)                                                \
+	do {                                                                       \
+		if (static_branch_unlikely(&ipts_mei_debug))                       \
+			dev_printk(KERN_DEBUG, dev, fmt, ##__VA_ARGS__);           \
+	} while (0)
 
 static void locked_list_add(struct list_head *new, struct list_head *head,
 			    struct rw_semaphore *lock)
@@ -35,6 +84,18 @@ static void locked_list_del(struct list_head *entry, struct rw_semaphore *lock)
 	up_write(lock);
 }
 
+/*
+ * The buffer index is only part of the answer to feedback, other messages use that space for
+ * something else.
+ */
+static int ipts_mei_index(struct ipts_response *response)
+{
+	if (response->cmd != IPTS_ME_2_HOST_MSG(IPTS_CMD_FEEDBACK))
+		return -1;
+
+	return response->payload.feedback.feedback_index;
+}
+
 static void ipts_mei_incoming(struct mei_cl_device *cldev)
 {
 	int i = 0;
@@ -60,39 +121,57 @@ static void ipts_mei_incoming(struct mei_cl_device *cldev)
 		if (ret != -EINTR)
 			break;
 
+		ipts_stats_inc(ipts->stats, IPTS_STAT_EINTR_RETRIES);
 		msleep(100);
 	}
 
 	if (ret < 0) {
+		ipts_stats_inc(ipts->stats, IPTS_STAT_RECV_ERRORS);
 		dev_err(ipts->dev, "Failed to read MEI message: %ld\n", ret);
 		return;
 	}
 
 	if (ret == 0) {
+		ipts_stats_inc(ipts->stats, IPTS_STAT_RECV_ERRORS);
 		dev_err(ipts->dev, "Received empty MEI message\n");
 		return;
 	}
 
-	dev_dbg(ipts->dev, "MEI thread received message with code 0x%X and status 0x%X\n",
-		entry->response.cmd, entry->response.status);
+	ipts_mei_dbg(ipts->dev, "MEI thread received message with code 0x%X and status 0x%X\n",
+		     entry->response.cmd, entry->response.status);
+
+	trace_ipts_mei_incoming(entry->response.cmd, entry->response.status,
+				ipts_mei_index(&entry->response));
 
 	locked_list_add(&entry->list, &ipts->mei.messages, &ipts->mei.message_lock);
 	wake_up_all(&ipts->mei.message_queue);
 }
 
-static int ipts_mei_search(struct ipts_mei *mei, enum ipts_command_code code,
+bool ipts_mei_match(struct ipts_response *response, enum ipts_command_code code, int index)
+{
+	if (response->cmd != IPTS_ME_2_HOST_MSG(code))
+		return false;
+
+	if (index < 0)
+		return true;
+
+	return response->payload.feedback.feedback_index == index;
+}
+
+static int ipts_mei_search(struct ipts_mei *mei, enum ipts_command_code code, int index,
 			   struct ipts_response *response)
 {
 	struct ipts_mei_message *entry = NULL;
+	struct ipts_context *ipts = mei_cldev_get_drvdata(mei->cldev);
 
 	down_read(&mei->message_lock);
 
 	/*
 	 * Iterate over the list of received messages, and check if there is one
-	 * matching the requested command code.
+	 * matching the requested command code (and feedback buffer, if one was given).
 	 */
 	list_for_each_entry(entry, &mei->messages, list) {
-		if (entry->response.cmd == IPTS_ME_2_HOST_MSG(code))
+		if (ipts_mei_match(&entry->response, code, index))
 			break;
 	}
 
@@ -108,11 +187,15 @@ static int ipts_mei_search(struct ipts_mei *mei, enum ipts_command_code code,
 		*response = entry->response;
 		devm_kfree(&mei->cldev->dev, entry);
 
-		dev_dbg(&mei->cldev->dev, "Driver read message with code 0x%X and status 0x%X\n",
-			response->cmd, response->status);
+		ipts_mei_dbg(&mei->cldev->dev, "Driver read message with code 0x%X and status 0x%X\n",
+			     response->cmd, response->status);
+
+		trace_ipts_mei_search(response->cmd, response->status, ipts_mei_index(response));
 
-		if (response->status == IPTS_STATUS_TIMEOUT)
+		if (response->status == IPTS_STATUS_TIMEOUT) {
+			ipts_stats_inc(ipts->stats, IPTS_STAT_TIMEOUTS);
 			return -EAGAIN;
+		}
 
 		/*
 		 * Ignore all errors that the spec allows us to ignore.
@@ -133,48 +216,107 @@ static int ipts_mei_search(struct ipts_mei *mei, enum ipts_command_code code,
 	return -EAGAIN;
 }
 
-int ipts_mei_recv_timeout(struct ipts_mei *mei, enum ipts_command_code code,
-			  struct ipts_response *response, u64 timeout)
+/*
+ * Waiting for a message can time out for harmless reasons, e.g. because the receiver thread is
+ * idle or because the touch sensor is still booting. Only if the caller gives up afterwards,
+ * the timeout counts as a failure, which is what count is for.
+ */
+static int ipts_mei_recv_match(struct ipts_mei *mei, enum ipts_command_code code, int index,
+			       struct ipts_response *response, u64 timeout, bool count)
 {
 	int ret = 0;
+	struct ipts_context *ipts = mei_cldev_get_drvdata(mei->cldev);
 
 	/*
 	 * A timeout of 0 means check and return immideately.
 	 */
 	if (timeout == 0)
-		return ipts_mei_search(mei, code, response);
+		return ipts_mei_search(mei, code, index, response);
 
 	/*
 	 * A timeout of less than 0 means to wait forever.
 	 */
 	if (timeout < 0) {
-		wait_event(mei->message_queue, ipts_mei_search(mei, code, response) == 0);
+		wait_event(mei->message_queue,
+			   ipts_mei_search(mei, code, index, response) == 0);
 		return 0;
 	}
 
-	ret = wait_event_timeout(mei->message_queue, ipts_mei_search(mei, code, response) == 0,
+	ret = wait_event_timeout(mei->message_queue,
+				 ipts_mei_search(mei, code, index, response) == 0,
 				 msecs_to_jiffies(timeout));
 
 	if (ret > 0)
 		return 0;
 
+	if (count)
+		ipts_stats_inc(ipts->stats, IPTS_STAT_TIMEOUTS);
+
 	return -EAGAIN;
 }
 
+int ipts_mei_recv_timeout(struct ipts_mei *mei, enum ipts_command_code code,
+			  struct ipts_response *response, u64 timeout)
+{
+	return ipts_mei_recv_match(mei, code, -1, response, timeout, false);
+}
+
+int ipts_mei_recv(struct ipts_mei *mei, enum ipts_command_code code,
+		  struct ipts_response *response)
+{
+	return ipts_mei_recv_match(mei, code, -1, response, 1 * MSEC_PER_SEC, true);
+}
+
+int ipts_mei_recv_feedback_timeout(struct ipts_mei *mei, u8 buffer,
+				   struct ipts_response *response, u64 timeout)
+{
+	return ipts_mei_recv_match(mei, IPTS_CMD_FEEDBACK, buffer, response, timeout, false);
+}
+
+int ipts_mei_recv_feedback(struct ipts_mei *mei, u8 buffer, struct ipts_response *response)
+{
+	return ipts_mei_recv_match(mei, IPTS_CMD_FEEDBACK, buffer, response, 1 * MSEC_PER_SEC,
+				   true);
+}
+
+void ipts_mei_flush(struct ipts_mei *mei, enum ipts_command_code code)
+{
+	struct ipts_mei_message *entry = NULL;
+	struct ipts_mei_message *tmp = NULL;
+
+	down_write(&mei->message_lock);
+
+	list_for_each_entry_safe(entry, tmp, &mei->messages, list) {
+		if (!ipts_mei_match(&entry->response, code, -1))
+			continue;
+
+		list_del(&entry->list);
+		devm_kfree(&mei->cldev->dev, entry);
+	}
+
+	up_write(&mei->message_lock);
+}
+
 int ipts_mei_send(struct ipts_mei *mei, enum ipts_command_code code, void *payload, size_t size)
 {
 	int i = 0;
 	int ret = 0;
 
 	struct ipts_command cmd = { 0 };
+	struct ipts_context *ipts = mei_cldev_get_drvdata(mei->cldev);
 
 	cmd.cmd = code;
 
 	if (payload && size > 0)
 		memcpy(cmd.payload.raw, payload, size);
 
-	dev_dbg(&mei->cldev->dev, "Driver sent message with code 0x%X and %ld bytes payload\n",
-		code, size);
+	ipts_mei_dbg(&mei->cldev->dev, "Driver sent message with code 0x%X and %zu bytes payload\n",
+		     code, size);
+
+	if (code == IPTS_CMD_FEEDBACK)
+		trace_ipts_mei_send(code, size, cmd.payload.feedback.buffer_index);
+	else
+		trace_ipts_mei_send(code, size, -1);
 
 	/*
 	 * System calls can interrupt the MEI bus API functions.
@@ -187,10 +329,12 @@ int ipts_mei_send(struct ipts_mei *mei, enum ipts_command_code code, void *paylo
 		if (ret != -EINTR)
 			break;
 
+		ipts_stats_inc(ipts->stats, IPTS_STAT_EINTR_RETRIES);
 		msleep(100);
 	}
 
 	if (ret < 0) {
+		ipts_stats_inc(ipts->stats, IPTS_STAT_SEND_ERRORS);
 		dev_err(&mei->cldev->dev, "Failed to send MEI message: %d\n", ret);
 		return ret;
 	}
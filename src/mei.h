@@ -53,15 +53,37 @@ struct ipts_mei_message {
 	struct ipts_response response;
 };
 
+/*
+ * Checks if a response answers the given command. If index is not negative, the response must
+ * also be the answer to feedback for that buffer.
+ */
+bool ipts_mei_match(struct ipts_response *response, enum ipts_command_code code, int index);
+
 int ipts_mei_send(struct ipts_mei *mei, enum ipts_command_code code, void *payload, size_t size);
 int ipts_mei_recv_timeout(struct ipts_mei *mei, enum ipts_command_code code,
 			  struct ipts_response *response, u64 timeout);
 
-static inline int ipts_mei_recv(struct ipts_mei *mei, enum ipts_command_code code,
-				struct ipts_response *response)
-{
-	return ipts_mei_recv_timeout(mei, code, response, 1 * MSEC_PER_SEC);
-}
+/*
+ * Waits for up to one second. Unlike with the variants that take a timeout, the ME not
+ * answering in time is considered a failure and counted as such.
+ */
+int ipts_mei_recv(struct ipts_mei *mei, enum ipts_command_code code,
+		  struct ipts_response *response);
+
+/*
+ * The receiver thread and the HID2ME path both send feedback at the same time. To not take
+ * each others responses, they are matched using the index of the feedback buffer.
+ */
+
+int ipts_mei_recv_feedback_timeout(struct ipts_mei *mei, u8 buffer,
+				   struct ipts_response *response, u64 timeout);
+int ipts_mei_recv_feedback(struct ipts_mei *mei, u8 buffer, struct ipts_response *response);
+
+/*
+ * Drops all messages with the given command code that nobody has read yet. After the touch
+ * sensor was reset, the answers to requests that were sent before are stale.
+ */
+void ipts_mei_flush(struct ipts_mei *mei, enum ipts_command_code code);
 
 void ipts_mei_init(struct ipts_mei *mei, struct mei_cl_device *cldev);
 
@@ -5,9 +5,13 @@
  * Linux driver for Intel Precise Touch & Stylus
  */
 
+#include <linux/bits.h>
 #include <linux/delay.h>
+#include <linux/dev_printk.h>
 #include <linux/err.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/minmax.h>
 #include <linux/time64.h>
 #include <linux/timekeeping.h>
 #include <linux/types.h>
@@ -19,43 +23,249 @@
 #include "resources.h"
 #include "spec-dma.h"
 #include "spec-mei.h"
+#include "spi.h"
+#include "stats.h"
 #include "thread.h"
+#include "trace.h"
+
+/*
+ * STALL_TIMEOUT - How long the doorbell may stand still while the ME owes us data.
+ *
+ * After that, the watchdog tries to get it moving again. Every further step of escalation
+ * waits for the same amount of time.
+ */
+#define STALL_TIMEOUT (1 * MSEC_PER_SEC)
+
+/*
+ * ERROR_BACKOFF_MIN - How long to wait after the first failure to talk to the ME, in ms.
+ * ERROR_BACKOFF_MAX - The longest the receiver will wait after a failure, in ms.
+ *
+ * The delay doubles with every failure in a row, so a device that fails persistently
+ * can't keep a CPU busy.
+ */
+#define ERROR_BACKOFF_MIN 1
+#define ERROR_BACKOFF_MAX (1 * MSEC_PER_SEC)
+
+/*
+ * ERROR_BUDGET - How many failures in a row are tolerated before the ME is set up again.
+ *
+ * With the backoff above, this is reached after about one second of persistent failures.
+ */
+#define ERROR_BUDGET 10
+
+/**
+ * struct ipts_receiver_errors - Tracks failures of a receiver loop to talk to the ME.
+ *
+ * @count:
+ *     How many failures occured in a row.
+ *
+ * @backoff:
+ *     How long to wait after the next failure, in milliseconds.
+ */
+struct ipts_receiver_errors {
+	unsigned int count;
+	unsigned int backoff;
+};
+
+static void ipts_receiver_success(struct ipts_receiver_errors *errors)
+{
+	errors->count = 0;
+	errors->backoff = ERROR_BACKOFF_MIN;
+}
+
+static void ipts_receiver_failure(struct ipts_context *ipts, struct ipts_receiver_errors *errors,
+				  int ret)
+{
+	if (++errors->count >= ERROR_BUDGET) {
+		dev_err(ipts->dev, "Too many errors in a row, recovering: %d\n", ret);
+		ipts_control_schedule_recovery(ipts, ret, IPTS_RESET_REASON_UNKNOWN);
+
+		ipts_receiver_success(errors);
+		return;
+	}
+
+	msleep(errors->backoff);
+	errors->backoff = min_t(unsigned int, errors->backoff * 2, ERROR_BACKOFF_MAX);
+}
+
+static void ipts_receiver_stall_done(struct ipts_context *ipts)
+{
+	ipts->stall_level = 0;
+
+	if (!ipts->stall_start)
+		return;
+
+	WRITE_ONCE(ipts->stall_time, ktime_us_delta(ktime_get(), ipts->stall_start));
+	ipts->stall_start = 0;
+
+	dev_info(ipts->dev, "Doorbell stall resolved after %u us\n", ipts->stall_time);
+}
+
+static void ipts_receiver_resend(struct ipts_context *ipts, u32 *unreturned)
+{
+	int i = 0;
+	int ret = 0;
+
+	for (i = 0; i < ipts->buffers; i++) {
+		struct ipts_data_buffer *buffer = NULL;
+
+		if (!(*unreturned & BIT(i)))
+			continue;
+
+		buffer = (struct ipts_data_buffer *)ipts->resources.data[i].address;
+
+		ret = ipts_control_refill_buffer(ipts, buffer);
+		if (ipts_control_check_reset(ipts, ret, IPTS_RESET_REASON_UNKNOWN))
+			return;
+
+		if (ret) {
+			dev_err_ratelimited(ipts->dev, "Failed to send feedback: %d\n", ret);
+			continue;
+		}
+
+		*unreturned &= ~BIT(i);
+	}
+}
+
+/**
+ * ipts_receiver_watchdog() - Notice when the doorbell stalls and try to get it moving again.
+ *
+ * The doorbell standing still is only a problem if buffers could not be given back to the ME,
+ * because otherwise the touch sensor may just have nothing to report. In that case, the watchdog
+ * first sends the missing feedback again, then resets the touch sensor, and finally sets up the
+ * ME from scratch.
+ *
+ * GET_FEATURE requests are not watched, because their answers can legitimately take many
+ * seconds to arrive. They have their own timeout.
+ *
+ * @ipts:
+ *     The IPTS driver context.
+ *
+ * @progress:
+ *     When the doorbell last moved, or the watchdog last took action.
+ *
+ * @moved:
+ *     Whether the doorbell has moved since the last call.
+ *
+ * @unreturned:
+ *     A bitmask of buffers for which sending feedback has failed.
+ */
+static void ipts_receiver_watchdog(struct ipts_context *ipts, ktime_t *progress, bool moved,
+				   u32 *unreturned)
+{
+	ktime_t now = ktime_get();
+
+	if (moved || !*unreturned) {
+		*progress = now;
+		ipts_receiver_stall_done(ipts);
+		return;
+	}
+
+	if (ktime_ms_delta(now, *progress) < STALL_TIMEOUT)
+		return;
+
+	*progress = now;
+
+	if (!ipts->stall_start) {
+		ipts->stall_start = now;
+		WRITE_ONCE(ipts->stall_count, ipts->stall_count + 1);
+	}
+
+	switch (ipts->stall_level++) {
+	case 0:
+		dev_warn(ipts->dev, "Doorbell stalled, sending feedback again\n");
+		ipts_receiver_resend(ipts, unreturned);
+		break;
+	case 1:
+		dev_warn(ipts->dev, "Doorbell still stalled, resetting touch sensor\n");
+
+		/*
+		 * Resetting has to stop this thread, so it is done from a work item.
+		 */
+		schedule_work(&ipts->reset_work);
+		break;
+	default:
+		dev_warn(ipts->dev, "Doorbell still stalled, restarting\n");
+		ipts_control_schedule_recovery(ipts, IPTS_STATUS_TIMEOUT, IPTS_RESET_REASON_UNKNOWN);
+		break;
+	}
+}
 
 static int ipts_receiver_event(struct ipts_thread *thread)
 {
 	int ret = 0;
 	struct ipts_context *ipts = thread->data;
+	struct ipts_receiver_errors errors = { 0 };
 
 	dev_info(ipts->dev, "IPTS running in event mode\n");
+	ipts_receiver_success(&errors);
 
 	while (!ipts_thread_should_stop(thread)) {
 		struct ipts_rsp_ready_for_data rsp = { 0 };
 		struct ipts_data_buffer *buffer = NULL;
+		ktime_t dispatch = 0;
+		int err = 0;
+
+		/*
+		 * After the touch sensor was reset, wait until we are stopped for recovery.
+		 */
+		if (READ_ONCE(ipts->recovering)) {
+			msleep(10);
+			continue;
+		}
 
 		ret = ipts_control_wait_data(ipts, &rsp);
 		if (ret == -EAGAIN)
 			continue;
 
+		if (ipts_control_check_reset(ipts, ret, rsp.reset_reason))
+			continue;
+
 		if (ret) {
-			dev_err(ipts->dev, "Failed to wait for data: %d\n", ret);
+			dev_err_ratelimited(ipts->dev, "Failed to wait for data: %d\n", ret);
+			ipts_receiver_failure(ipts, &errors, ret);
 			continue;
 		}
 
 		buffer = (struct ipts_data_buffer *)ipts->resources.data[rsp.buffer_index].address;
+		dispatch = ktime_get();
+
+		ret = ipts_spi_check_buffer(ipts, buffer);
+		if (!ret)
+			ret = ipts_hid_input_data(ipts, buffer);
+
+		ipts_stats_latency(ipts->stats, IPTS_LATENCY_DISPATCH_HID, dispatch);
 
-		ret = ipts_hid_input_data(ipts, buffer);
 		if (ret)
-			dev_err(ipts->dev, "Failed to process buffer: %d\n", ret);
+			dev_err_ratelimited(ipts->dev, "Failed to process buffer: %d\n", ret);
 
 		ret = ipts_control_refill_buffer(ipts, buffer);
-		if (ret)
-			dev_err(ipts->dev, "Failed to send feedback: %d\n", ret);
+		if (ipts_control_check_reset(ipts, ret, IPTS_RESET_REASON_UNKNOWN))
+			continue;
+
+		if (ret) {
+			dev_err_ratelimited(ipts->dev, "Failed to send feedback: %d\n", ret);
+			err = ret;
+		}
 
 		ret = ipts_control_request_data(ipts);
-		if (ret)
-			dev_err(ipts->dev, "Failed to request data: %d\n", ret);
+		if (ret) {
+			dev_err_ratelimited(ipts->dev, "Failed to request data: %d\n", ret);
+			err = err ?: ret;
+		}
+
+		if (err)
+			ipts_receiver_failure(ipts, &errors, err);
+		else
+			ipts_receiver_success(&errors);
 	}
 
+	/*
+	 * If the touch sensor was reset, the ME has nothing left to flush.
+	 */
+	if (READ_ONCE(ipts->recovering))
+		return 0;
+
 	ret = ipts_control_request_flush(ipts);
 	if (ret) {
 		dev_err(ipts->dev, "Failed to request flush: %d\n", ret);
@@ -91,13 +301,36 @@ static int ipts_receiver_poll(struct ipts_thread *thread)
 
 	struct ipts_context *ipts = thread->data;
 	time64_t last = ktime_get_seconds();
+	ktime_t progress = ktime_get();
+	ktime_t doorbell = 0;
 
 	u32 current_buffer = 0;
 	u32 next_buffer = 0;
+	u32 unreturned = 0;
+	u32 overruns = 0;
+	bool moved = false;
+	bool answered = false;
+
+	struct ipts_receiver_errors errors = { 0 };
 
 	dev_info(ipts->dev, "IPTS running in poll mode\n");
+	ipts_receiver_success(&errors);
 
 	while (true) {
+		struct ipts_rsp_ready_for_data rsp = { 0 };
+
+		/*
+		 * After the touch sensor was reset, wait until we are stopped for recovery.
+		 * The ME has nothing left to flush.
+		 */
+		if (READ_ONCE(ipts->recovering)) {
+			if (ipts_thread_should_stop(thread))
+				return 0;
+
+			msleep(10);
+			continue;
+		}
+
 		if (ipts_thread_should_stop(thread)) {
 			ret = ipts_control_request_flush(ipts);
 			if (ret) {
@@ -117,20 +350,61 @@ static int ipts_receiver_poll(struct ipts_thread *thread)
 		 * We read the doorbell address only once to force the loop to sleep at some point.
 		 */
 		next_buffer = *(u32 *)ipts->resources.doorbell.address;
+		doorbell = ktime_get();
+		moved = current_buffer != next_buffer;
+
+		trace_ipts_doorbell(current_buffer, next_buffer);
+
+		if (moved)
+			ipts_stats_inc(ipts->stats, IPTS_STAT_POLL_DATA);
+		else
+			ipts_stats_inc(ipts->stats, IPTS_STAT_POLL_EMPTY);
+
+		/*
+		 * If the ME has gone around all buffers since the last wakeup, it has overwritten
+		 * data that we did not get to see.
+		 */
+		overruns = ipts_receiver_overruns(current_buffer, next_buffer, ipts->buffers);
+		if (overruns)
+			ipts_stats_add(ipts->stats, IPTS_STAT_OVERRUNS, overruns);
 
 		while (current_buffer != next_buffer) {
 			struct ipts_data_buffer *buffer = NULL;
 			size_t index = current_buffer % ipts->buffers;
+			ktime_t dispatch = 0;
 
 			buffer = (struct ipts_data_buffer *)ipts->resources.data[index].address;
 
-			ret = ipts_hid_input_data(ipts, buffer);
+			dispatch = ktime_get();
+			ipts_stats_latency(ipts->stats, IPTS_LATENCY_DOORBELL_DISPATCH, doorbell);
+
+			ret = ipts_spi_check_buffer(ipts, buffer);
+			if (!ret)
+				ret = ipts_hid_input_data(ipts, buffer);
+
+			ipts_stats_latency(ipts->stats, IPTS_LATENCY_DISPATCH_HID, dispatch);
+
 			if (ret)
-				dev_err(ipts->dev, "Failed to process buffer: %d\n", ret);
+				dev_err_ratelimited(ipts->dev, "Failed to process buffer: %d\n", ret);
 
 			ret = ipts_control_refill_buffer(ipts, buffer);
+			if (ipts_control_check_reset(ipts, ret, IPTS_RESET_REASON_UNKNOWN))
+				break;
+
+			if (ret) {
+				dev_err_ratelimited(ipts->dev, "Failed to send feedback: %d\n", ret);
+				unreturned |= BIT(index);
+			} else {
+				unreturned &= ~BIT(index);
+			}
+
 			if (ret)
-				dev_err(ipts->dev, "Failed to send feedback: %d\n", ret);
+				ipts_receiver_failure(ipts, &errors, ret);
+			else
+				ipts_receiver_success(&errors);
+
+			if (READ_ONCE(ipts->recovering))
+				break;
 
 			last = ktime_get_seconds();
 			current_buffer++;
@@ -139,25 +413,48 @@ static int ipts_receiver_poll(struct ipts_thread *thread)
 		if (ipts_thread_should_stop(thread))
 			break;
 
+		/*
+		 * Starting the data flow leaves one READY_FOR_DATA request outstanding, which the
+		 * ME uses to report that the touch sensor was reset. Any other answer to it is
+		 * consumed here as well, so the wait for it during shutdown must be skipped.
+		 */
+		if (!answered) {
+			ret = ipts_control_check_data(ipts, &rsp);
+			if (ret != -EAGAIN)
+				answered = true;
+
+			if (ipts_control_check_reset(ipts, ret, rsp.reset_reason))
+				continue;
+		}
+
+		ipts_receiver_watchdog(ipts, &progress, moved, &unreturned);
+
 		/*
 		 * If the last change was less than 5 seconds ago, sleep for a shorter period so
 		 * that new data can be processed quickly. If there was no change for more than
 		 * 5 seconds, sleep longer to avoid wasting CPU cycles.
+		 *
+		 * If the sensor has been put to sleep because nobody is using it, no new data is
+		 * expected at all, so the loop can wake up even less often.
 		 */
 		if (last + 5 > ktime_get_seconds())
 			usleep_range(1 * USEC_PER_MSEC, 5 * USEC_PER_MSEC);
+		else if (READ_ONCE(ipts->sensor_idle))
+			msleep(1000);
 		else
 			msleep(200);
 	}
 
-	ret = ipts_control_wait_data(ipts, NULL);
-	if (ret) {
-		dev_err(ipts->dev, "Failed to wait for data: %d\n", ret);
+	if (!answered) {
+		ret = ipts_control_wait_data(ipts, NULL);
+		if (ret) {
+			dev_err(ipts->dev, "Failed to wait for data: %d\n", ret);
 
-		if (ret != -EAGAIN)
-			return ret;
-		else
-			return 0;
+			if (ret != -EAGAIN)
+				return ret;
+			else
+				return 0;
+		}
 	}
 
 	ret = ipts_control_wait_flush(ipts);
@@ -177,6 +474,12 @@ int ipts_receiver_start(struct ipts_context *ipts)
 {
 	int ret = -EINVAL;
 
+	/*
+	 * A new receiver starts out with a fresh data flow. Escalation of an earlier stall must
+	 * not carry over, or the next stall would immediately set up the ME again.
+	 */
+	ipts_receiver_stall_done(ipts);
+
 	if (ipts->mode == IPTS_MODE_EVENT)
 		ret = ipts_thread_start(&ipts->receiver, ipts_receiver_event, ipts, "ipts_event");
 	else if (ipts->mode == IPTS_MODE_POLL)
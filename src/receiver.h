@@ -8,8 +8,25 @@
 #ifndef IPTS_RECEIVER_H
 #define IPTS_RECEIVER_H
 
+#include <linux/types.h>
+
 #include "context.h"
 
+/*
+ * The doorbell counts every buffer that the ME has filled, and wraps around at U32_MAX.
+ * If it has moved by more than the number of buffers since it was last read, the ME has
+ * overwritten the difference before the driver could process it.
+ */
+static inline u32 ipts_receiver_overruns(u32 from, u32 to, u8 buffers)
+{
+	u32 filled = to - from;
+
+	if (filled <= buffers)
+		return 0;
+
+	return filled - buffers;
+}
+
 int ipts_receiver_start(struct ipts_context *ipts);
 int ipts_receiver_stop(struct ipts_context *ipts);
 
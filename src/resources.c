@@ -99,10 +99,6 @@ int ipts_resources_init(struct ipts_resources *resources, struct device *dev,
 	if (ret)
 		goto err;
 
-	ret = ipts_resources_alloc_dma(&resources->descriptor, dev, info.data_size + 8);
-	if (ret)
-		goto err;
-
 	ret = ipts_resources_alloc_buffer(&resources->report, IPTS_HID_REPORT_DATA_SIZE);
 	if (ret)
 		goto err;
@@ -132,7 +128,17 @@ void ipts_resources_free(struct ipts_resources *resources)
 	ipts_resources_free_dma(&resources->doorbell);
 	ipts_resources_free_dma(&resources->workqueue);
 	ipts_resources_free_dma(&resources->hid2me);
-	ipts_resources_free_dma(&resources->descriptor);
 	ipts_resources_free_buffer(&resources->report);
 	ipts_resources_free_buffer(&resources->feature);
 }
+
+int ipts_resources_alloc_descriptor(struct ipts_resources *resources, struct device *dev,
+				    struct ipts_rsp_get_device_info info)
+{
+	return ipts_resources_alloc_dma(&resources->descriptor, dev, info.data_size + 8);
+}
+
+void ipts_resources_free_descriptor(struct ipts_resources *resources)
+{
+	ipts_resources_free_dma(&resources->descriptor);
+}
@@ -57,7 +57,10 @@ struct ipts_dma_buffer {
  *
  * @descriptor:
  *     The buffer for querying the native HID descriptor on EDS v2 devices. The size of the buffer
- *     should &struct ipts_device_info->data_size + 8.
+ *     should &struct ipts_device_info->data_size + 8. Since the descriptor is cached once it has
+ *     been read, this buffer is only allocated while the query is running. Because the ME can
+ *     still be working on a query while the other buffers are allocated, it is managed separately
+ *     and not freed by ipts_resources_free().
  *
  * @report:
  *     A buffer that is used to synthesize HID reports on EDS v1 devices that don't natively support
@@ -85,4 +88,8 @@ int ipts_resources_init(struct ipts_resources *resources, struct device *dev,
 			struct ipts_rsp_get_device_info info);
 void ipts_resources_free(struct ipts_resources *resources);
 
+int ipts_resources_alloc_descriptor(struct ipts_resources *resources, struct device *dev,
+				    struct ipts_rsp_get_device_info info);
+void ipts_resources_free_descriptor(struct ipts_resources *resources);
+
 #endif /* IPTS_RESOURCES_H */
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#include <linux/atomic.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "spi.h"
+#include "context.h"
+#include "control.h"
+#include "spec-dma.h"
+#include "spec-mei.h"
+
+/*
+ * How many broken buffers are tolerated within IPTS_SPI_ERROR_WINDOW before a setting is given up.
+ */
+#define IPTS_SPI_MAX_ERRORS 8
+
+/*
+ * The length of the window in which broken buffers are counted, in milliseconds.
+ */
+#define IPTS_SPI_ERROR_WINDOW (10 * MSEC_PER_SEC)
+
+static bool spi_negotiate;
+module_param(spi_negotiate, bool, 0444);
+MODULE_PARM_DESC(spi_negotiate,
+		 "Try to run the SPI bus as fast as possible. Overrides the SPI policy. (default: false)");
+
+/*
+ * The settings are tried from fastest to slowest. 10MHz and 50MHz are not supported by the ME.
+ */
+static const struct ipts_spi_setting ipts_spi_settings[] = {
+	{ IPTS_SPI_FREQ_OVERRIDE_30MHZ, IPTS_SPI_IO_MODE_OVERRIDE_QUAD, IPTS_SPI_FREQ_30MHZ,
+	  IPTS_SPI_IO_QUAD },
+	{ IPTS_SPI_FREQ_OVERRIDE_30MHZ, IPTS_SPI_IO_MODE_OVERRIDE_DUAL, IPTS_SPI_FREQ_30MHZ,
+	  IPTS_SPI_IO_DUAL },
+	{ IPTS_SPI_FREQ_OVERRIDE_17MHZ, IPTS_SPI_IO_MODE_OVERRIDE_QUAD, IPTS_SPI_FREQ_17MHZ,
+	  IPTS_SPI_IO_QUAD },
+	{ IPTS_SPI_FREQ_OVERRIDE_17MHZ, IPTS_SPI_IO_MODE_OVERRIDE_DUAL, IPTS_SPI_FREQ_17MHZ,
+	  IPTS_SPI_IO_DUAL },
+};
+
+/*
+ * Returns the setting that is tried at the given position, or NULL once all of them have
+ * been used up.
+ */
+const struct ipts_spi_setting *ipts_spi_get_setting(u8 index)
+{
+	if (index >= ARRAY_SIZE(ipts_spi_settings))
+		return NULL;
+
+	return &ipts_spi_settings[index];
+}
+
+static int ipts_spi_apply(struct ipts_context *ipts, const struct ipts_spi_setting *setting)
+{
+	int ret = 0;
+
+	if (setting) {
+		ipts->policy.spi_freq_override = setting->freq_override;
+		ipts->policy.spi_io_mode_override = setting->io_mode_override;
+	} else {
+		ipts->policy.spi_freq_override = IPTS_SPI_FREQ_OVERRIDE_NONE;
+		ipts->policy.spi_io_mode_override = IPTS_SPI_IO_MODE_OVERRIDE_NONE;
+	}
+
+	ipts->policy_set = true;
+
+	ret = ipts_control_set_policy(ipts);
+	if (ret)
+		return ret;
+
+	if (!setting)
+		return 0;
+
+	/*
+	 * The ME accepts overrides that the sensor cannot handle, so check what it is really using.
+	 */
+	ret = ipts_control_get_device_info(ipts);
+	if (ret)
+		return ret;
+
+	if (ipts->info.spi_frequency != setting->freq || ipts->info.spi_io_mode != setting->io_mode)
+		return -EOPNOTSUPP;
+
+	return 0;
+}
+
+int ipts_spi_negotiate(struct ipts_context *ipts)
+{
+	int ret = 0;
+	const struct ipts_spi_setting *setting = NULL;
+
+	if (!spi_negotiate)
+		return 0;
+
+	atomic_set(&ipts->spi_errors, 0);
+	ipts->spi_window = 0;
+
+	mutex_lock(&ipts->policy_lock);
+
+	while ((setting = ipts_spi_get_setting(ipts->spi_setting))) {
+		ret = ipts_spi_apply(ipts, setting);
+		if (!ret)
+			break;
+
+		dev_dbg(ipts->dev, "SPI setting %u was rejected: %d\n", ipts->spi_setting, ret);
+		ipts->spi_setting++;
+	}
+
+	/*
+	 * If nothing worked, go back to what the sensor asks for by itself.
+	 */
+	if (!setting) {
+		ret = ipts_spi_apply(ipts, NULL);
+		if (!ret)
+			ret = ipts_control_get_device_info(ipts);
+	}
+
+	mutex_unlock(&ipts->policy_lock);
+
+	if (ret)
+		return ret;
+
+	dev_info(ipts->dev, "SPI bus running with frequency %u and IO mode %u\n",
+		 ipts->info.spi_frequency, ipts->info.spi_io_mode);
+
+	return 0;
+}
+
+static void ipts_spi_error(struct ipts_context *ipts)
+{
+	ktime_t now = ktime_get();
+
+	if (!spi_negotiate)
+		return;
+
+	/*
+	 * A broken buffer every now and then can happen with any setting. Only a burst of them
+	 * means that the bus is running too fast.
+	 */
+	if (ktime_ms_delta(now, ipts->spi_window) >= IPTS_SPI_ERROR_WINDOW) {
+		ipts->spi_window = now;
+		atomic_set(&ipts->spi_errors, 0);
+	}
+
+	if (atomic_inc_return(&ipts->spi_errors) != IPTS_SPI_MAX_ERRORS)
+		return;
+
+	if (!ipts_spi_get_setting(ipts->spi_setting))
+		return;
+
+	schedule_work(&ipts->spi_work);
+}
+
+int ipts_spi_check_buffer(struct ipts_context *ipts, struct ipts_data_buffer *buffer)
+{
+	/*
+	 * If the bus is running too fast, the header can get corrupted, which usually shows up
+	 * as a size that doesn't fit into the buffer.
+	 */
+	if (buffer->size <= ipts->info.data_size - sizeof(*buffer))
+		return 0;
+
+	ipts_spi_error(ipts);
+	return -EBADMSG;
+}
+
+void ipts_spi_fallback_work(struct work_struct *work)
+{
+	int ret = 0;
+	struct ipts_context *ipts = container_of(work, struct ipts_context, spi_work);
+
+	dev_warn(ipts->dev, "SPI setting %u is unreliable, falling back\n", ipts->spi_setting);
+
+	mutex_lock(&ipts->policy_lock);
+	ipts->spi_setting++;
+	mutex_unlock(&ipts->policy_lock);
+
+	ret = ipts_control_restart(ipts);
+	if (ret)
+		dev_err(ipts->dev, "Failed to restart IPTS: %d\n", ret);
+}
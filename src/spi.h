@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#ifndef IPTS_SPI_H
+#define IPTS_SPI_H
+
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "context.h"
+#include "spec-dma.h"
+#include "spec-mei.h"
+
+/**
+ * struct ipts_spi_setting - A combination of SPI bus frequency and IO mode.
+ *
+ * @freq_override:
+ *     The frequency that is requested from the ME.
+ *
+ * @io_mode_override:
+ *     The IO mode that is requested from the ME.
+ *
+ * @freq:
+ *     The frequency that the ME must report when the setting was applied.
+ *
+ * @io_mode:
+ *     The IO mode that the ME must report when the setting was applied.
+ */
+struct ipts_spi_setting {
+	enum ipts_spi_freq_override freq_override;
+	enum ipts_spi_io_override io_mode_override;
+	enum ipts_spi_freq freq;
+	enum ipts_spi_io io_mode;
+};
+
+const struct ipts_spi_setting *ipts_spi_get_setting(u8 index);
+
+int ipts_spi_negotiate(struct ipts_context *ipts);
+int ipts_spi_check_buffer(struct ipts_context *ipts, struct ipts_data_buffer *buffer);
+void ipts_spi_fallback_work(struct work_struct *work);
+
+#endif /* IPTS_SPI_H */
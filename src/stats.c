@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "stats.h"
+
+u64 ipts_stats_read(struct ipts_stats __percpu *stats, enum ipts_stat stat)
+{
+	int cpu = 0;
+	u64 value = 0;
+
+	for_each_possible_cpu(cpu)
+		value += per_cpu_ptr(stats, cpu)->counters[stat];
+
+	return value;
+}
+
+u64 ipts_stats_read_latency(struct ipts_stats __percpu *stats, enum ipts_latency stage,
+			    unsigned int bucket)
+{
+	int cpu = 0;
+	u64 value = 0;
+
+	for_each_possible_cpu(cpu)
+		value += per_cpu_ptr(stats, cpu)->latency[stage][bucket];
+
+	return value;
+}
+
+void ipts_stats_reset_latency(struct ipts_stats __percpu *stats)
+{
+	int cpu = 0;
+
+	/*
+	 * This can race with CPUs that are recording a sample at the same time, which at worst
+	 * loses that sample.
+	 */
+	for_each_possible_cpu(cpu) {
+		struct ipts_stats *local = per_cpu_ptr(stats, cpu);
+
+		memset(local->latency, 0, sizeof(local->latency));
+	}
+}
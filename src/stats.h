@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#ifndef IPTS_STATS_H
+#define IPTS_STATS_H
+
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include <linux/minmax.h>
+#include <linux/percpu.h>
+#include <linux/types.h>
+
+/**
+ * enum ipts_stat - Counters for the data path of the driver.
+ *
+ * @IPTS_STAT_FRAME_RECEIVED:
+ *     Buffers with raw touch data that were received from the ME.
+ *
+ * @IPTS_STAT_FRAME_FORWARDED:
+ *     Buffers with raw touch data that were forwarded to the HID core.
+ *
+ * @IPTS_STAT_HID_RECEIVED:
+ *     Buffers with HID reports that were received from the ME.
+ *
+ * @IPTS_STAT_HID_FORWARDED:
+ *     Buffers with HID reports that were forwarded to the HID core.
+ *
+ * @IPTS_STAT_FEATURES_RECEIVED:
+ *     Answers to GET_FEATURES requests that were received from the ME.
+ *
+ * @IPTS_STAT_UNKNOWN_RECEIVED:
+ *     Buffers of unknown type that were received from the ME.
+ *
+ * @IPTS_STAT_BYTES_RECEIVED:
+ *     The amount of data that was received from the ME, without the buffer headers.
+ *
+ * @IPTS_STAT_REFILL_ERRORS:
+ *     How often a buffer could not be given back to the ME.
+ *
+ * @IPTS_STAT_SEND_ERRORS:
+ *     How often sending a message to the ME failed.
+ *
+ * @IPTS_STAT_RECV_ERRORS:
+ *     How often reading a message from the ME failed.
+ *
+ * @IPTS_STAT_EINTR_RETRIES:
+ *     How often talking to the ME was interrupted and had to be repeated.
+ *
+ * @IPTS_STAT_TIMEOUTS:
+ *     How often the driver gave up waiting for an answer from the ME, or the ME reported
+ *     a timeout. Waits that are simply repeated, like those of the idle receiver thread,
+ *     are not counted.
+ *
+ * @IPTS_STAT_POLL_DATA:
+ *     Wakeups of the poll loop that found new data.
+ *
+ * @IPTS_STAT_POLL_EMPTY:
+ *     Wakeups of the poll loop that found nothing to do.
+ *
+ * @IPTS_STAT_OVERRUNS:
+ *     Buffers that were overwritten by the ME before the driver could process them.
+ */
+enum ipts_stat {
+	IPTS_STAT_FRAME_RECEIVED,
+	IPTS_STAT_FRAME_FORWARDED,
+	IPTS_STAT_HID_RECEIVED,
+	IPTS_STAT_HID_FORWARDED,
+	IPTS_STAT_FEATURES_RECEIVED,
+	IPTS_STAT_UNKNOWN_RECEIVED,
+	IPTS_STAT_BYTES_RECEIVED,
+	IPTS_STAT_REFILL_ERRORS,
+	IPTS_STAT_SEND_ERRORS,
+	IPTS_STAT_RECV_ERRORS,
+	IPTS_STAT_EINTR_RETRIES,
+	IPTS_STAT_TIMEOUTS,
+	IPTS_STAT_POLL_DATA,
+	IPTS_STAT_POLL_EMPTY,
+	IPTS_STAT_OVERRUNS,
+	IPTS_STAT_COUNT,
+};
+
+/**
+ * enum ipts_latency - The stages of the data path whose latency is recorded.
+ *
+ * @IPTS_LATENCY_DOORBELL_DISPATCH:
+ *     From the poll loop noticing that the doorbell has moved, until a buffer is dispatched.
+ *
+ * @IPTS_LATENCY_DISPATCH_HID:
+ *     From dispatching a buffer, until the HID core is done with it.
+ *
+ * @IPTS_LATENCY_FEEDBACK:
+ *     From sending feedback for a buffer, until the ME has acknowledged it.
+ *
+ * @IPTS_LATENCY_READY_FOR_DATA:
+ *     From requesting data in event mode, until the ME reports that a buffer was filled.
+ *
+ * @IPTS_LATENCY_GET_FEATURE:
+ *     From sending a GET_FEATURE request, until its answer has arrived.
+ */
+enum ipts_latency {
+	IPTS_LATENCY_DOORBELL_DISPATCH,
+	IPTS_LATENCY_DISPATCH_HID,
+	IPTS_LATENCY_FEEDBACK,
+	IPTS_LATENCY_READY_FOR_DATA,
+	IPTS_LATENCY_GET_FEATURE,
+	IPTS_LATENCY_COUNT,
+};
+
+/*
+ * IPTS_LATENCY_BUCKETS - How many buckets each latency histogram has.
+ *
+ * Bucket n counts latencies of less than 2^n nanoseconds that did not fit into bucket n - 1.
+ * The last bucket also takes everything that is even slower (2^35 ns are about 34 seconds).
+ */
+#define IPTS_LATENCY_BUCKETS 36
+
+/**
+ * struct ipts_stats - The counters of one CPU.
+ *
+ * Every CPU only ever touches its own copy, so counting doesn't need locks or atomics.
+ * Readers add up the copies of all CPUs.
+ *
+ * @counters:
+ *     The value of each counter. See &enum ipts_stat.
+ *
+ * @latency:
+ *     A histogram with log2 sized buckets for each stage. See &enum ipts_latency.
+ */
+struct ipts_stats {
+	u64 counters[IPTS_STAT_COUNT];
+	u64 latency[IPTS_LATENCY_COUNT][IPTS_LATENCY_BUCKETS];
+};
+
+static inline void ipts_stats_add(struct ipts_stats __percpu *stats, enum ipts_stat stat,
+				  u64 value)
+{
+	this_cpu_add(stats->counters[stat], value);
+}
+
+static inline void ipts_stats_inc(struct ipts_stats __percpu *stats, enum ipts_stat stat)
+{
+	this_cpu_inc(stats->counters[stat]);
+}
+
+static inline unsigned int ipts_stats_bucket(s64 ns)
+{
+	unsigned int bucket = ns > 0 ? fls64(ns) : 0;
+
+	return min_t(unsigned int, bucket, IPTS_LATENCY_BUCKETS - 1);
+}
+
+static inline void ipts_stats_latency(struct ipts_stats __percpu *stats, enum ipts_latency stage,
+				      ktime_t start)
+{
+	s64 delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	this_cpu_inc(stats->latency[stage][ipts_stats_bucket(delta)]);
+}
+
+u64 ipts_stats_read(struct ipts_stats __percpu *stats, enum ipts_stat stat);
+u64 ipts_stats_read_latency(struct ipts_stats __percpu *stats, enum ipts_latency stage,
+			    unsigned int bucket);
+void ipts_stats_reset_latency(struct ipts_stats __percpu *stats);
+
+#endif /* IPTS_STATS_H */
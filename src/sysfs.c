@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#include <linux/device.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "sysfs.h"
+#include "context.h"
+#include "control.h"
+#include "spec-mei.h"
+
+/*
+ * Reading a policy attribute returns the value that the ME is actually using. Writing to it
+ * changes the policy that the driver requests from the ME. That policy is applied immediately
+ * and on every following start of the driver.
+ */
+
+static ssize_t ipts_sysfs_show_policy(struct device *dev, char *buf,
+				      u32 (*field)(struct ipts_policy *policy))
+{
+	int ret = 0;
+	struct ipts_policy policy = { 0 };
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	/*
+	 * Only one GET_POLICY request may be in flight, or the readers would race for the answer.
+	 */
+	mutex_lock(&ipts->policy_lock);
+	ret = ipts_control_get_policy(ipts, &policy);
+	mutex_unlock(&ipts->policy_lock);
+
+	if (ret > 0)
+		return -EIO;
+
+	if (ret < 0)
+		return ret;
+
+	return sysfs_emit(buf, "%u\n", field(&policy));
+}
+
+static ssize_t ipts_sysfs_store_policy(struct device *dev, const char *buf, size_t count,
+				       u32 max, void (*field)(struct ipts_policy *policy, u32 value))
+{
+	int ret = 0;
+	u32 value = 0;
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	ret = kstrtou32(buf, 0, &value);
+	if (ret)
+		return ret;
+
+	if (value > max)
+		return -EINVAL;
+
+	mutex_lock(&ipts->policy_lock);
+
+	field(&ipts->policy, value);
+	ipts->policy_set = true;
+
+	ret = ipts_control_set_policy(ipts);
+
+	mutex_unlock(&ipts->policy_lock);
+
+	if (ret > 0)
+		return -EIO;
+
+	if (ret < 0)
+		return ret;
+
+	return count;
+}
+
+static u32 ipts_sysfs_get_doze_timer(struct ipts_policy *policy)
+{
+	return policy->doze_timer;
+}
+
+static void ipts_sysfs_set_doze_timer(struct ipts_policy *policy, u32 value)
+{
+	policy->doze_timer = value;
+}
+
+static ssize_t doze_timer_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return ipts_sysfs_show_policy(dev, buf, ipts_sysfs_get_doze_timer);
+}
+
+static ssize_t doze_timer_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	return ipts_sysfs_store_policy(dev, buf, count, U16_MAX, ipts_sysfs_set_doze_timer);
+}
+
+static DEVICE_ATTR_RW(doze_timer);
+
+static u32 ipts_sysfs_get_spi_freq_override(struct ipts_policy *policy)
+{
+	return policy->spi_freq_override;
+}
+
+static void ipts_sysfs_set_spi_freq_override(struct ipts_policy *policy, u32 value)
+{
+	policy->spi_freq_override = value;
+}
+
+static ssize_t spi_freq_override_show(struct device *dev, struct device_attribute *attr,
+				      char *buf)
+{
+	return ipts_sysfs_show_policy(dev, buf, ipts_sysfs_get_spi_freq_override);
+}
+
+static ssize_t spi_freq_override_store(struct device *dev, struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	return ipts_sysfs_store_policy(dev, buf, count, IPTS_SPI_FREQ_OVERRIDE_50MHZ,
+				       ipts_sysfs_set_spi_freq_override);
+}
+
+static DEVICE_ATTR_RW(spi_freq_override);
+
+static u32 ipts_sysfs_get_spi_io_mode_override(struct ipts_policy *policy)
+{
+	return policy->spi_io_mode_override;
+}
+
+static void ipts_sysfs_set_spi_io_mode_override(struct ipts_policy *policy, u32 value)
+{
+	policy->spi_io_mode_override = value;
+}
+
+static ssize_t spi_io_mode_override_show(struct device *dev, struct device_attribute *attr,
+					 char *buf)
+{
+	return ipts_sysfs_show_policy(dev, buf, ipts_sysfs_get_spi_io_mode_override);
+}
+
+static ssize_t spi_io_mode_override_store(struct device *dev, struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	return ipts_sysfs_store_policy(dev, buf, count, IPTS_SPI_IO_MODE_OVERRIDE_QUAD,
+				       ipts_sysfs_set_spi_io_mode_override);
+}
+
+static DEVICE_ATTR_RW(spi_io_mode_override);
+
+/*
+ * The SPI settings that the touch sensor is actually running with. They can be changed through
+ * the policy, or negotiated automatically with the spi_negotiate module parameter.
+ */
+
+static ssize_t spi_frequency_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", ipts->info.spi_frequency);
+}
+
+static DEVICE_ATTR_RO(spi_frequency);
+
+static ssize_t spi_io_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", ipts->info.spi_io_mode);
+}
+
+static DEVICE_ATTR_RO(spi_io_mode);
+
+/*
+ * How long the HID device must be unused before the touch sensor is put to sleep, in
+ * milliseconds. Putting the sensor to sleep is opt-in, the default of 0 disables it.
+ */
+
+static ssize_t sleep_delay_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(ipts->sleep_delay));
+}
+
+static ssize_t sleep_delay_store(struct device *dev, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	int ret = 0;
+	unsigned int value = 0;
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	ret = kstrtouint(buf, 0, &value);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(ipts->sleep_delay, value);
+
+	/*
+	 * The new delay applies the next time the HID device is closed.
+	 */
+	if (!value)
+		cancel_delayed_work_sync(&ipts->sleep_work);
+
+	return count;
+}
+
+static DEVICE_ATTR_RW(sleep_delay);
+
+/*
+ * How long the touch sensor needed to become ready during the last start, in milliseconds.
+ */
+
+static ssize_t ready_time_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(ipts->ready_time));
+}
+
+static DEVICE_ATTR_RO(ready_time);
+
+/*
+ * How often the driver had to recover from a reset of the touch sensor, and how long the
+ * last recovery took in microseconds.
+ */
+
+static ssize_t recovery_count_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(ipts->recovery_count));
+}
+
+static DEVICE_ATTR_RO(recovery_count);
+
+static ssize_t recovery_time_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(ipts->recovery_time));
+}
+
+static DEVICE_ATTR_RO(recovery_time);
+
+/*
+ * How often the doorbell stalled in poll mode, and how long it took in microseconds until
+ * the last stall was resolved.
+ */
+
+static ssize_t stall_count_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(ipts->stall_count));
+}
+
+static DEVICE_ATTR_RO(stall_count);
+
+static ssize_t stall_time_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(ipts->stall_time));
+}
+
+static DEVICE_ATTR_RO(stall_time);
+
+/*
+ * Writing "soft" or "hard" resets the touch sensor, without tearing down the driver.
+ */
+
+static ssize_t reset_store(struct device *dev, struct device_attribute *attr, const char *buf,
+			   size_t count)
+{
+	int ret = 0;
+	enum ipts_reset_type type = IPTS_RESET_TYPE_SOFT;
+	struct ipts_context *ipts = dev_get_drvdata(dev);
+
+	if (sysfs_streq(buf, "soft"))
+		type = IPTS_RESET_TYPE_SOFT;
+	else if (sysfs_streq(buf, "hard"))
+		type = IPTS_RESET_TYPE_HARD;
+	else
+		return -EINVAL;
+
+	ret = ipts_control_reset(ipts, type);
+	if (ret > 0)
+		return -EIO;
+
+	if (ret < 0)
+		return ret;
+
+	return count;
+}
+
+static DEVICE_ATTR_WO(reset);
+
+static struct attribute *ipts_sysfs_attrs[] = {
+	&dev_attr_doze_timer.attr,
+	&dev_attr_spi_freq_override.attr,
+	&dev_attr_spi_io_mode_override.attr,
+	&dev_attr_spi_frequency.attr,
+	&dev_attr_spi_io_mode.attr,
+	&dev_attr_sleep_delay.attr,
+	&dev_attr_ready_time.attr,
+	&dev_attr_recovery_count.attr,
+	&dev_attr_recovery_time.attr,
+	&dev_attr_stall_count.attr,
+	&dev_attr_stall_time.attr,
+	&dev_attr_reset.attr,
+	NULL,
+};
+
+static const struct attribute_group ipts_sysfs_group = {
+	.attrs = ipts_sysfs_attrs,
+};
+
+const struct attribute_group *ipts_sysfs_groups[] = {
+	&ipts_sysfs_group,
+	NULL,
+};
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#ifndef IPTS_SYSFS_H
+#define IPTS_SYSFS_H
+
+#include <linux/sysfs.h>
+
+extern const struct attribute_group *ipts_sysfs_groups[];
+
+#endif /* IPTS_SYSFS_H */
@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2023 Dorian Stoll
+ *
+ * Linux driver for Intel Precise Touch & Stylus
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ipts
+
+#if !defined(IPTS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define IPTS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+/*
+ * Messages going from the host to the ME. For feedback, index is the buffer that is given back
+ * to the ME, which can also be the HID2ME buffer. It is -1 for all other commands.
+ */
+TRACE_EVENT(ipts_mei_send,
+	TP_PROTO(u32 code, size_t size, int index),
+	TP_ARGS(code, size, index),
+
+	TP_STRUCT__entry(
+		__field(u32, code)
+		__field(size_t, size)
+		__field(int, index)
+	),
+
+	TP_fast_assign(
+		__entry->code = code;
+		__entry->size = size;
+		__entry->index = index;
+	),
+
+	TP_printk("code=0x%x size=%zu index=%d", __entry->code, __entry->size, __entry->index)
+);
+
+/*
+ * Messages going from the ME to the host. They are traced once when they arrive, and once
+ * when the driver picks them up. Only answers to feedback carry a buffer index, for all other
+ * messages it is -1.
+ */
+DECLARE_EVENT_CLASS(ipts_mei_message,
+	TP_PROTO(u32 cmd, u32 status, int index),
+	TP_ARGS(cmd, status, index),
+
+	TP_STRUCT__entry(
+		__field(u32, cmd)
+		__field(u32, status)
+		__field(int, index)
+	),
+
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->status = status;
+		__entry->index = index;
+	),
+
+	TP_printk("cmd=0x%x status=0x%x index=%d", __entry->cmd, __entry->status, __entry->index)
+);
+
+DEFINE_EVENT(ipts_mei_message, ipts_mei_incoming,
+	TP_PROTO(u32 cmd, u32 status, int index),
+	TP_ARGS(cmd, status, index)
+);
+
+DEFINE_EVENT(ipts_mei_message, ipts_mei_search,
+	TP_PROTO(u32 cmd, u32 status, int index),
+	TP_ARGS(cmd, status, index)
+);
+
+/*
+ * The poll loop has read the doorbell. Every value between current and doorbell stands for
+ * a buffer that was filled by the ME.
+ */
+TRACE_EVENT(ipts_doorbell,
+	TP_PROTO(u32 current_buffer, u32 doorbell),
+	TP_ARGS(current_buffer, doorbell),
+
+	TP_STRUCT__entry(
+		__field(u32, current_buffer)
+		__field(u32, doorbell)
+	),
+
+	TP_fast_assign(
+		__entry->current_buffer = current_buffer;
+		__entry->doorbell = doorbell;
+	),
+
+	TP_printk("current=%u doorbell=%u", __entry->current_buffer, __entry->doorbell)
+);
+
+/*
+ * A data buffer is being dispatched to the HID layer.
+ */
+TRACE_EVENT(ipts_input_data,
+	TP_PROTO(u8 index, u32 type, u32 size, u32 total_index, u32 transaction),
+	TP_ARGS(index, type, size, total_index, transaction),
+
+	TP_STRUCT__entry(
+		__field(u8, index)
+		__field(u32, type)
+		__field(u32, size)
+		__field(u32, total_index)
+		__field(u32, transaction)
+	),
+
+	TP_fast_assign(
+		__entry->index = index;
+		__entry->type = type;
+		__entry->size = size;
+		__entry->total_index = total_index;
+		__entry->transaction = transaction;
+	),
+
+	TP_printk("index=%u type=%u size=%u total_index=%u transaction=%u", __entry->index,
+		  __entry->type, __entry->size, __entry->total_index, __entry->transaction)
+);
+
+/*
+ * A data buffer is given back to the ME, and the ME has acknowledged it.
+ */
+TRACE_EVENT(ipts_feedback,
+	TP_PROTO(u8 index, u32 total_index, u32 transaction),
+	TP_ARGS(index, total_index, transaction),
+
+	TP_STRUCT__entry(
+		__field(u8, index)
+		__field(u32, total_index)
+		__field(u32, transaction)
+	),
+
+	TP_fast_assign(
+		__entry->index = index;
+		__entry->total_index = total_index;
+		__entry->transaction = transaction;
+	),
+
+	TP_printk("index=%u total_index=%u transaction=%u", __entry->index,
+		  __entry->total_index, __entry->transaction)
+);
+
+TRACE_EVENT(ipts_feedback_done,
+	TP_PROTO(u8 index, u32 transaction, int status),
+	TP_ARGS(index, transaction, status),
+
+	TP_STRUCT__entry(
+		__field(u8, index)
+		__field(u32, transaction)
+		__field(int, status)
+	),
+
+	TP_fast_assign(
+		__entry->index = index;
+		__entry->transaction = transaction;
+		__entry->status = status;
+	),
+
+	TP_printk("index=%u transaction=%u status=%d", __entry->index, __entry->transaction,
+		  __entry->status)
+);
+
+#endif /* IPTS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+
+#include <trace/define_trace.h>